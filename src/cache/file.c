@@ -14,11 +14,16 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <libgen.h>
 #include <semaphore.h>
 #include "config.h"
 #include "log.h"
 #include "object.h"
 #include "misc.h"
+#include "bucket.h"
+#include "volume.h"
 #include "cache/file.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -29,15 +34,21 @@
 // Section:     Object cache table
 
 const struct object_cache_intr file_intr = {
-  .load         = file_load,
+  .load          = file_load,
+  .unload        = file_unload,
 
-  .get_max      = file_get_max,
-  .get_capacity = file_get_capacity,
+  .get_max       = file_get_max,
+  .get_max_count = file_get_max_count,
+  .get_capacity  = file_get_capacity,
 
-  .create       = file_create,
-  .read         = file_read,
-  .write        = file_write,
-  .destroy      = file_destroy,
+  .create        = file_create,
+  .read          = file_read,
+  .write         = file_write,
+  .destroy       = file_destroy,
+
+  .persist       = file_persist,
+  .sync          = file_sync,
+  .restore       = file_restore,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -47,31 +58,74 @@ static sem_t file_stat_lock;
 
 static uint64_t file_used = 0;
 
+static uint64_t file_max_count = 0;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Cache file path
 
 static const char *file_path = NULL;
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Slot file, free list protected by the stat lock
+
+static int32_t file_slot_fd = -1;
+
+static uint32_t *file_slot_free = NULL;
+
+static uint32_t file_slot_count = 0,
+                file_slot_free_count = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Persistent slot index
+
+static int32_t file_index_fd = -1;
+
+static struct file_index_record *file_index = NULL;
+
+// Records wait here for the next sync, which writes them after one sync of
+// the slot data. The stage and the records above share the index lock.
+static struct file_index_stage *file_stage = NULL;
+
+static uint32_t *file_stage_list = NULL,
+                *file_sync_list = NULL;
+
+static uint32_t file_stage_count = 0;
+
+static sem_t file_index_lock;
+
+static bool file_index_restored = false;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Initialization
 
-void file_load() {
+void file_load(uint64_t cache_max, uint64_t cache_max_count) {
   struct object_cache *tmp;
   struct rlimit rlim;
-  uint32_t limit;
+  uint64_t limit;
 
   sem_init(&file_stat_lock, 0, 1);
 
-  limit = OBJECT_MAX_CACHE_COUNT + FILE_LIMIT_RESERVE;
+  if (config_get("cache-file")) {
+    file_load_slots(config_get("cache-file"), cache_max);
+    return;
+  }
+
+  // Every cached object holds a descriptor, a large cache is capped at
+  // whatever the hard limit allows.
   if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
     stderror("getrlimit");
-  if (rlim.rlim_max < limit)
-    error("Open file limit must be greater than %d", limit);
+  if (rlim.rlim_max < OBJECT_MIN_CACHE_COUNT + FILE_LIMIT_RESERVE)
+    error("Open file limit must be greater than %d",
+          OBJECT_MIN_CACHE_COUNT + FILE_LIMIT_RESERVE);
+
+  limit = min(cache_max_count + FILE_LIMIT_RESERVE,
+              rlim.rlim_max);
   if (rlim.rlim_cur < limit) {
     rlim.rlim_cur = limit;
     if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
       stderror("setrlimit");
   }
+  file_max_count = max(rlim.rlim_cur, limit) - FILE_LIMIT_RESERVE;
 
   if (!(file_path = config_get("cache-path")))
     error("Must specify --cache-path");
@@ -81,13 +135,82 @@ void file_load() {
   file_destroy(tmp);
 }
 
+void file_unload() {
+  // Objects and their slots outlive an unload, only what was written so far
+  // has to be on disk.
+  file_sync();
+  if (file_slot_fd >= 0 && fdatasync(file_slot_fd) < 0)
+    stderror("fdatasync");
+  if (file_index_fd >= 0 && fdatasync(file_index_fd) < 0)
+    stderror("fdatasync");
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Memory maximums and capacity
 
+void file_load_slots(const char *path, uint64_t cache_max) {
+  struct stat st;
+  uint64_t size;
+  uint32_t i;
+
+  // Cached objects outlive an unload, so a slot file that is already open
+  // is kept for them.
+  if (file_slot_fd >= 0)
+    return;
+
+  if ((file_slot_fd = open(path, O_RDWR | O_CREAT, (mode_t) 0600)) < 0)
+    error("Opening cache file failed %s: %s", path, strerror(errno));
+  if (fstat(file_slot_fd, &st) < 0)
+    stderror("fstat");
+
+  if (S_ISBLK(st.st_mode)) {
+    if (ioctl(file_slot_fd, BLKGETSIZE64, &size) < 0)
+      stderror("ioctl");
+    file_slot_count = size / OBJECT_MAX_SIZE;
+    if (file_slot_count < cache_max / OBJECT_MAX_SIZE +
+                          FILE_SPARE_SLOTS)
+      error("Cache device %s is smaller than the cache max", path);
+  } else {
+    file_slot_count = cache_max / OBJECT_MAX_SIZE +
+                      FILE_SPARE_SLOTS;
+    size = (uint64_t) file_slot_count * OBJECT_MAX_SIZE;
+
+    if ((errno = posix_fallocate(file_slot_fd, 0, size)) != 0)
+      error("Allocating cache file failed %s: %s", path, strerror(errno));
+  }
+
+  if (config_get("cache-persist"))
+    file_index_load(path, S_ISBLK(st.st_mode));
+
+  // Slots still owned by an indexed object stay off the free list until
+  // the object is evicted.
+  if (!(file_slot_free = malloc(sizeof(*file_slot_free) * file_slot_count)))
+    stderror("malloc");
+  file_slot_free_count = 0;
+  for (i = file_slot_count; i-- > 0; ) {
+    if (!file_index || !(file_index[i].flag & FILE_INDEX_VALID))
+      file_slot_free[file_slot_free_count++] = i;
+  }
+
+  // Objects beyond the spare slots land in their own files, next to the
+  // cache file unless a path is given.
+  file_max_count = file_slot_count - FILE_SPARE_SLOTS;
+  if (!(file_path = config_get("cache-path"))) {
+    if (S_ISBLK(st.st_mode))
+      file_path = P_tmpdir;
+    else if (!(file_path = strdup(dirname(strdupa(path)))))
+      stderror("strdup");
+  }
+}
+
 uint64_t file_get_max() {
   return FILE_DEFAULT_MAX;
 }
 
+uint64_t file_get_max_count() {
+  return file_max_count;
+}
+
 uint64_t file_get_capacity() {
   uint64_t __file_used;
 
@@ -103,18 +226,15 @@ uint64_t file_get_capacity() {
 
 struct object_cache *file_create() {
   struct file_cache *file;
-  char *fname;
 
   if (!(file = calloc(sizeof(*file), 1)))
     stderror("calloc");
 
-  asprintf(&fname, "%s/cloudfs.cache.%x.%x.%x",
-           file_path, rand(), rand(), rand());
-  if ((file->fd = open(fname, O_RDWR | O_CREAT, (mode_t) 0600)) < 0)
-    error("Creating new cache file failed %s: %s",
-          fname, strerror(errno));
-  unlink(fname);
-  free(fname);
+  file->slot = FILE_NO_SLOT;
+  if (file_slot_fd >= 0)
+    file->fd = -1;
+  else
+    file->fd = file_open_private();
 
   return (struct object_cache *) file;
 }
@@ -126,7 +246,14 @@ int file_read(struct object_cache *cache, uint32_t offt, char *buf,
 
   file = (struct file_cache *) cache;
 
-  if ((rlen = pread(file->fd, buf, *len, offt)) < 0)
+  // A slot holds stale data past the end of the object.
+  if (offt >= file->len) {
+    *len = 0;
+    return SUCCESS;
+  }
+  *len = min(*len, file->len - offt);
+
+  if ((rlen = pread(file->fd, buf, *len, file_base(file) + offt)) < 0)
     stderror("pread");
 
   *len = rlen;
@@ -141,16 +268,23 @@ int file_write(struct object_cache *cache, uint32_t offt, const char *buf,
 
   file = (struct file_cache *) cache;
 
+  if (file->fd < 0)
+    file_slot_take(file);
+  else if (file_index && file->slot != FILE_NO_SLOT)
+    file_index_drop_clean(file->slot);
+
   new_size = len + offt;
   if (new_size > file->len) {
     sem_wait(&file_stat_lock);
     file_used += new_size - file->len;
     sem_post(&file_stat_lock);
 
+    if (offt > file->len && file->slot != FILE_NO_SLOT)
+      file_zero(file, file->len, offt - file->len);
     file->len = new_size;
   }
 
-  if ((rlen = pwrite(file->fd, buf, len, offt)) < 0)
+  if ((rlen = pwrite(file->fd, buf, len, file_base(file) + offt)) < 0)
     stderror("pread");
   return SUCCESS;
 }
@@ -165,7 +299,304 @@ int file_destroy(struct object_cache *cache) {
   file_used -= file->len;
   sem_post(&file_stat_lock);
 
-  close(file->fd);
+  if (file->slot != FILE_NO_SLOT)
+    file_slot_give(file);
+  else if (file->fd >= 0)
+    close(file->fd);
   free(file);
   return SUCCESS;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Private files
+
+int32_t file_open_private() {
+  char *fname;
+  int32_t fd;
+
+  asprintf(&fname, "%s/cloudfs.cache.%x.%x.%x",
+           file_path, rand(), rand(), rand());
+  if ((fd = open(fname, O_RDWR | O_CREAT, (mode_t) 0600)) < 0)
+    error("Creating new cache file failed %s: %s",
+          fname, strerror(errno));
+  unlink(fname);
+  free(fname);
+
+  return fd;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Slot allocation
+
+void file_slot_take(struct file_cache *file) {
+  sem_wait(&file_stat_lock);
+  if (file_slot_free_count)
+    file->slot = file_slot_free[--file_slot_free_count];
+  sem_post(&file_stat_lock);
+
+  if (file->slot != FILE_NO_SLOT)
+    file->fd = file_slot_fd;
+  else
+    file->fd = file_open_private();
+}
+
+void file_slot_give(struct file_cache *file) {
+  if (file_index) {
+    sem_wait(&file_index_lock);
+    memset(&file_stage[file->slot].rec, 0, sizeof(*file_index));
+    if ((file_index[file->slot].flag & FILE_INDEX_VALID)) {
+      memset(&file_index[file->slot], 0, sizeof(*file_index));
+      file_index_write(file->slot);
+    }
+    sem_post(&file_index_lock);
+  }
+
+  sem_wait(&file_stat_lock);
+  file_slot_free[file_slot_free_count++] = file->slot;
+  sem_post(&file_stat_lock);
+
+  file->slot = FILE_NO_SLOT;
+  file->fd = -1;
+}
+
+uint64_t file_base(struct file_cache *file) {
+  if (file->slot == FILE_NO_SLOT)
+    return 0;
+  return (uint64_t) file->slot * OBJECT_MAX_SIZE;
+}
+
+void file_zero(struct file_cache *file, uint32_t offt, uint32_t len) {
+  static const char zero[FILE_ZERO_SIZE];
+  uint32_t wlen;
+
+  while (len) {
+    wlen = min(len, sizeof(zero));
+    if (pwrite(file->fd, zero, wlen, file_base(file) + offt) < 0)
+      stderror("pwrite");
+    offt += wlen;
+    len -= wlen;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Persistent slot index
+
+void file_index_load(const char *path, bool is_device) {
+  struct file_index_header hdr, disk_hdr;
+  const char *index_path;
+  char *default_path;
+  uint64_t size;
+  uint32_t i;
+
+  default_path = NULL;
+  if (!(index_path = config_get("cache-index"))) {
+    if (is_device)
+      error("Must specify --cache-index for cache device %s", path);
+    asprintf(&default_path, "%s.index", path);
+    index_path = default_path;
+  }
+
+  if ((file_index_fd = open(index_path, O_RDWR | O_CREAT, (mode_t) 0600)) < 0)
+    error("Opening cache index failed %s: %s", index_path, strerror(errno));
+  if (default_path)
+    free(default_path);
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, FILE_INDEX_MAGIC, sizeof(hdr.magic));
+  hdr.version = FILE_INDEX_VERSION;
+  hdr.slot_count = file_slot_count;
+  hdr.ctime = volume_get_ctime();
+  strncpy(hdr.bucket, bucket_get_selected() ?: "", sizeof(hdr.bucket) - 1);
+  strncpy(hdr.volume, volume_get_selected() ?: "", sizeof(hdr.volume) - 1);
+
+  size = (uint64_t) file_slot_count * sizeof(*file_index);
+  if (!(file_index = calloc(file_slot_count, sizeof(*file_index))))
+    stderror("calloc");
+  if (!(file_stage = calloc(file_slot_count, sizeof(*file_stage))))
+    stderror("calloc");
+  if (!(file_stage_list = malloc(sizeof(*file_stage_list) * file_slot_count)))
+    stderror("malloc");
+  if (!(file_sync_list = malloc(sizeof(*file_sync_list) * file_slot_count)))
+    stderror("malloc");
+  file_stage_count = 0;
+  sem_init(&file_index_lock, 0, 1);
+
+  // The index is only trusted when it was written for this very volume and
+  // slot layout, anything else starts the cache cold.
+  if (pread(file_index_fd, &disk_hdr, sizeof(disk_hdr),
+            0) == sizeof(disk_hdr) &&
+      !memcmp(&hdr, &disk_hdr, sizeof(hdr)) &&
+      pread(file_index_fd, file_index, size,
+            FILE_INDEX_HEADER_SIZE) == (ssize_t) size) {
+    for (i = 0; i < file_slot_count; i++) {
+      if (file_index[i].len > OBJECT_MAX_SIZE ||
+          file_index[i].range_count > FILE_INDEX_RANGES)
+        memset(&file_index[i], 0, sizeof(*file_index));
+    }
+    return;
+  }
+
+  memset(file_index, 0, size);
+  if (ftruncate(file_index_fd, 0) < 0 ||
+      ftruncate(file_index_fd, FILE_INDEX_HEADER_SIZE + size) < 0)
+    stderror("ftruncate");
+  if (pwrite(file_index_fd, &hdr, sizeof(hdr), 0) < 0)
+    stderror("pwrite");
+
+  file_index_restored = true;
+}
+
+void file_index_write(uint32_t slot) {
+  if (pwrite(file_index_fd, &file_index[slot], sizeof(*file_index),
+             FILE_INDEX_HEADER_SIZE +
+             (uint64_t) slot * sizeof(*file_index)) < 0)
+    stderror("pwrite");
+}
+
+void file_index_drop_clean(uint32_t slot) {
+  // A clean record vouches for the data in the slot, so it is dropped before
+  // that data changes, from the disk and from the stage. Nothing is synced,
+  // an empty record describes no data. Dirty records are refreshed later.
+  sem_wait(&file_index_lock);
+  if ((file_stage[slot].rec.flag & (FILE_INDEX_VALID | FILE_INDEX_DIRTY)) ==
+      FILE_INDEX_VALID)
+    memset(&file_stage[slot].rec, 0, sizeof(*file_index));
+  if ((file_index[slot].flag & (FILE_INDEX_VALID | FILE_INDEX_DIRTY)) ==
+      FILE_INDEX_VALID) {
+    memset(&file_index[slot], 0, sizeof(*file_index));
+    file_index_write(slot);
+  }
+  sem_post(&file_index_lock);
+}
+
+void file_persist(struct object_cache *cache) {
+  struct file_index_stage *stage;
+  struct file_index_record rec;
+  struct file_cache *file;
+  uint32_t i;
+
+  file = (struct file_cache *) cache;
+
+  if (!file_index || file->slot == FILE_NO_SLOT)
+    return;
+
+  // A partial object with more ranges than fit in a record can not be
+  // described, so its record is dropped and a restore treats the slot as
+  // lost. The flush fetches the rest of the object as it always does.
+  memset(&rec, 0, sizeof(rec));
+  if (!(cache->flag & OBJECT_CACHE_NOT_PRESENT) ||
+      cache->trxlog.size <= FILE_INDEX_RANGES) {
+    rec.flag = FILE_INDEX_VALID;
+    if ((cache->flag & OBJECT_CACHE_DIRTY))
+      rec.flag |= FILE_INDEX_DIRTY;
+    if ((cache->flag & OBJECT_CACHE_NOT_PRESENT))
+      rec.flag |= FILE_INDEX_NOT_PRESENT;
+
+    rec.len = file->len;
+    rec.object = cache->object;
+    memcpy(rec.md5, cache->md5, sizeof(rec.md5));
+
+    if ((cache->flag & OBJECT_CACHE_NOT_PRESENT)) {
+      rec.range_count = cache->trxlog.size;
+      for (i = 0; i < rec.range_count; i++)
+        rec.range[i] = cache->trxlog.range[i];
+    }
+  }
+
+  sem_wait(&file_index_lock);
+  stage = &file_stage[file->slot];
+  if (memcmp(&rec, stage->pending ? &stage->rec : &file_index[file->slot],
+             sizeof(rec))) {
+    stage->rec = rec;
+    if (!stage->pending) {
+      stage->pending = true;
+      file_stage_list[file_stage_count++] = file->slot;
+    }
+  }
+  sem_post(&file_index_lock);
+}
+
+void file_sync() {
+  struct file_index_stage *stage;
+  uint32_t i, count;
+
+  if (!file_index)
+    return;
+
+  sem_wait(&file_index_lock);
+  count = file_stage_count;
+  for (i = 0; i < count; i++) {
+    file_sync_list[i] = file_stage_list[i];
+    file_stage[file_sync_list[i]].pending = false;
+  }
+  file_stage_count = 0;
+  sem_post(&file_index_lock);
+
+  if (!count)
+    return;
+
+  // The slot data has to reach the disk before a record that describes it,
+  // otherwise a crash can restore the record over stale slot contents. One
+  // sync covers every record staged before it, a record staged again since
+  // waits for the next one.
+  if (fdatasync(file_slot_fd) < 0)
+    stderror("fdatasync");
+
+  sem_wait(&file_index_lock);
+  for (i = 0; i < count; i++) {
+    stage = &file_stage[file_sync_list[i]];
+    if (stage->pending || !memcmp(&stage->rec, &file_index[file_sync_list[i]],
+                                  sizeof(stage->rec)))
+      continue;
+
+    file_index[file_sync_list[i]] = stage->rec;
+    file_index_write(file_sync_list[i]);
+  }
+  sem_post(&file_index_lock);
+}
+
+void file_restore() {
+  struct file_index_record *rec;
+  struct file_cache *file;
+  uint32_t i, j, count, dirty;
+
+  if (!file_index || file_index_restored)
+    return;
+  file_index_restored = true;
+
+  count = dirty = 0;
+  for (i = 0; i < file_slot_count; i++) {
+    rec = &file_index[i];
+    if (!(rec->flag & FILE_INDEX_VALID))
+      continue;
+
+    if (!(file = calloc(sizeof(*file), 1)))
+      stderror("calloc");
+
+    file->fd = file_slot_fd;
+    file->slot = i;
+    file->len = rec->len;
+
+    sem_wait(&file_stat_lock);
+    file_used += file->len;
+    sem_post(&file_stat_lock);
+
+    file->obj.object = rec->object;
+    memcpy(file->obj.md5, rec->md5, sizeof(rec->md5));
+    if ((rec->flag & FILE_INDEX_DIRTY)) {
+      file->obj.flag |= OBJECT_CACHE_DIRTY;
+      dirty++;
+    }
+    if ((rec->flag & FILE_INDEX_NOT_PRESENT))
+      file->obj.flag |= OBJECT_CACHE_NOT_PRESENT;
+    for (j = 0; j < rec->range_count; j++)
+      trxlog_add(&file->obj.trxlog, rec->range[j].from,
+                 rec->range[j].to - rec->range[j].from);
+
+    object_cache_restore(&file->obj);
+    count++;
+  }
+
+  if (count)
+    notice("Restored %u cached objects, %u dirty", count, dirty);
+}
@@ -18,6 +18,17 @@
 
 #define FILE_LIMIT_RESERVE  32
 
+#define FILE_SPARE_SLOTS    16
+#define FILE_NO_SLOT        UINT32_MAX
+
+#define FILE_ZERO_SIZE      (64 * 1024)
+
+#define FILE_INDEX_MAGIC        "CFSCACHE"
+#define FILE_INDEX_VERSION      1
+#define FILE_INDEX_HEADER_SIZE  4096
+#define FILE_INDEX_RANGES       16
+#define FILE_INDEX_NAME_MAX     256
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache table
 
@@ -29,18 +40,51 @@ extern const struct object_cache_intr file_intr;
 struct file_cache {
   struct object_cache obj;
   int32_t fd;
-  uint32_t len;
+  uint32_t len, slot;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Persistent slot index
+
+enum file_index_flag {
+  FILE_INDEX_VALID       = 1 << 0,
+  FILE_INDEX_DIRTY       = 1 << 1,
+  FILE_INDEX_NOT_PRESENT = 1 << 2,
+};
+
+struct file_index_header {
+  char magic[8];
+  uint32_t version, slot_count;
+  uint64_t ctime;
+  char bucket[FILE_INDEX_NAME_MAX];
+  char volume[FILE_INDEX_NAME_MAX];
+} __attribute__((packed));
+
+struct file_index_record {
+  uint32_t flag, len;
+  struct volume_object object;
+  char md5[OBJECT_MD5_DIGEST_LENGTH];
+  uint32_t range_count;
+  struct trxlog_range range[FILE_INDEX_RANGES];
+} __attribute__((packed));
+
+struct file_index_stage {
+  struct file_index_record rec;
+  bool pending;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Initialization
 
-void file_load();
+void file_load(uint64_t cache_max, uint64_t cache_max_count);
+void file_unload();
+void file_load_slots(const char *path, uint64_t cache_max);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Memory maximums and capacity
 
 uint64_t file_get_max();
+uint64_t file_get_max_count();
 uint64_t file_get_capacity();
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -52,3 +96,26 @@ int file_read(struct object_cache *cache, uint32_t offt, char *buf,
 int file_write(struct object_cache *cache, uint32_t offt, const char *buf,
                uint32_t len);
 int file_destroy(struct object_cache *cache);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Private files
+
+int32_t file_open_private();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Slot allocation
+
+void file_slot_take(struct file_cache *file);
+void file_slot_give(struct file_cache *file);
+uint64_t file_base(struct file_cache *file);
+void file_zero(struct file_cache *file, uint32_t offt, uint32_t len);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Persistent slot index
+
+void file_index_load(const char *path, bool is_device);
+void file_index_write(uint32_t slot);
+void file_index_drop_clean(uint32_t slot);
+void file_persist(struct object_cache *cache);
+void file_sync();
+void file_restore();
@@ -9,6 +9,7 @@
 #include <string.h>
 #include <stdint.h>
 #include <semaphore.h>
+#include <sys/mman.h>
 #include "config.h"
 #include "log.h"
 #include "object.h"
@@ -23,15 +24,16 @@
 // Section:     Object cache table
 
 const struct object_cache_intr memory_intr = {
-  .load         = memory_load,
+  .load          = memory_load,
 
-  .get_max      = memory_get_max,
-  .get_capacity = memory_get_capacity,
+  .get_max       = memory_get_max,
+  .get_max_count = memory_get_max_count,
+  .get_capacity  = memory_get_capacity,
 
-  .create       = memory_create,
-  .read         = memory_read,
-  .write        = memory_write,
-  .destroy      = memory_destroy,
+  .create        = memory_create,
+  .read          = memory_read,
+  .write         = memory_write,
+  .destroy       = memory_destroy,
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -41,11 +43,59 @@ static sem_t memory_stat_lock;
 
 static uint64_t memory_used = 0;
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Slot pool, protected by the stat lock
+
+static char *memory_pool = NULL;
+
+static uint32_t *memory_pool_free = NULL;
+
+static uint32_t memory_pool_size = 0,
+                memory_pool_free_count = 0;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Initialization
 
-void memory_load() {
+void memory_load(uint64_t cache_max, uint64_t cache_max_count) {
+  uint32_t i;
+
   sem_init(&memory_stat_lock, 0, 1);
+
+  // Cached objects outlive an unload, so a pool that already exists is kept
+  // for them.
+  if (memory_pool)
+    return;
+
+  memory_pool_size = max(cache_max / OBJECT_MAX_SIZE, 1);
+  memory_pool = memory_pool_map((uint64_t) memory_pool_size * OBJECT_MAX_SIZE,
+                                config_get("memory-hugepages") != NULL);
+
+  if (!(memory_pool_free = malloc(sizeof(*memory_pool_free) *
+                                  memory_pool_size)))
+    stderror("malloc");
+  for (i = 0; i < memory_pool_size; i++)
+    memory_pool_free[i] = memory_pool_size - i - 1;
+  memory_pool_free_count = memory_pool_size;
+}
+
+char *memory_pool_map(uint64_t size, bool hugepages) {
+  void *pool;
+
+  if (hugepages) {
+    pool = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (pool != MAP_FAILED)
+      return pool;
+    warning("Reserved huge pages unavailable, using transparent huge pages");
+  }
+
+  if ((pool = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    stderror("mmap");
+
+  if (hugepages && madvise(pool, size, MADV_HUGEPAGE) < 0)
+    warning("Transparent huge pages unavailable: %s", strerror(errno));
+  return pool;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -55,6 +105,12 @@ uint64_t memory_get_max() {
   return MEMORY_DEFAULT_MAX;
 }
 
+uint64_t memory_get_max_count() {
+  // Every object with data holds a whole slot, so the pool and not the
+  // entry size bounds how many fit.
+  return memory_pool_size;
+}
+
 uint64_t memory_get_capacity() {
   uint64_t __memory_used;
 
@@ -73,6 +129,7 @@ struct object_cache *memory_create() {
 
   if (!(mem = calloc(sizeof(*mem), 1)))
     stderror("calloc");
+  mem->slot = MEMORY_NO_SLOT;
   return (struct object_cache *) mem;
 }
 
@@ -101,14 +158,18 @@ int memory_write(struct object_cache *cache, uint32_t offt, const char *buf,
 
   mem = (struct memory_cache *) cache;
 
+  // Buffers always hold a whole object, so growing one never moves it.
+  if (!mem->data)
+    memory_slot_take(mem);
+
   rlen = len + offt;
   if (rlen > mem->len) {
     sem_wait(&memory_stat_lock);
     memory_used += rlen - mem->len;
     sem_post(&memory_stat_lock);
 
-    if (!(mem->data = realloc(mem->data, rlen)))
-      stderror("realloc");
+    if (offt > mem->len)
+      memset(mem->data + mem->len, 0, offt - mem->len);
     mem->len = rlen;
   }
 
@@ -127,7 +188,46 @@ int memory_destroy(struct object_cache *cache) {
   sem_post(&memory_stat_lock);
 
   if (mem->data)
-    free(mem->data);
+    memory_slot_give(mem);
   free(mem);
   return SUCCESS;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Slot allocation
+
+void memory_slot_take(struct memory_cache *mem) {
+  // The entry limit matches the pool, objects that are reserved but not
+  // yet evicted can briefly need more and wait for the reclaimer to free a
+  // slot. Only when the reclaimer is stopped, or is the caller, does a
+  // slot come from the heap instead.
+  while (true) {
+    sem_wait(&memory_stat_lock);
+    if (memory_pool_free_count)
+      mem->slot = memory_pool_free[--memory_pool_free_count];
+    sem_post(&memory_stat_lock);
+
+    if (mem->slot != MEMORY_NO_SLOT) {
+      mem->data = memory_pool + (uint64_t) mem->slot * OBJECT_MAX_SIZE;
+      return;
+    }
+    if (!object_cache_reclaim_wait())
+      break;
+  }
+
+  if (!(mem->data = malloc(OBJECT_MAX_SIZE)))
+    stderror("malloc");
+}
+
+void memory_slot_give(struct memory_cache *mem) {
+  if (mem->slot == MEMORY_NO_SLOT) {
+    free(mem->data);
+  } else {
+    sem_wait(&memory_stat_lock);
+    memory_pool_free[memory_pool_free_count++] = mem->slot;
+    sem_post(&memory_stat_lock);
+  }
+
+  mem->data = NULL;
+  mem->slot = MEMORY_NO_SLOT;
+}
@@ -16,6 +16,8 @@
 
 #define MEMORY_DEFAULT_MAX  (16 * 1024 * 1024)
 
+#define MEMORY_NO_SLOT      UINT32_MAX
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache table
 
@@ -27,18 +29,20 @@ extern const struct object_cache_intr memory_intr;
 struct memory_cache {
   struct object_cache obj;
   char *data;
-  uint32_t len;
+  uint32_t len, slot;
 };
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Initialization
 
-void memory_load();
+void memory_load(uint64_t cache_max, uint64_t cache_max_count);
+char *memory_pool_map(uint64_t size, bool hugepages);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Memory maximums and capacity
 
 uint64_t memory_get_max();
+uint64_t memory_get_max_count();
 uint64_t memory_get_capacity();
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -50,3 +54,9 @@ int memory_read(struct object_cache *cache, uint32_t offt, char *buf,
 int memory_write(struct object_cache *cache, uint32_t offt, const char *buf,
                  uint32_t len);
 int memory_destroy(struct object_cache *cache);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Slot allocation
+
+void memory_slot_take(struct memory_cache *mem);
+void memory_slot_give(struct memory_cache *mem);
@@ -0,0 +1,351 @@
+/*
+ * cloudfs: zmemory source
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <semaphore.h>
+#include <zlib.h>
+#include "config.h"
+#include "log.h"
+#include "object.h"
+#include "misc.h"
+#include "cache/zmemory.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class:       zmemory
+// Description: Compressed memory cache medium. Objects are kept as
+//              independently compressed segments, so an access only inflates
+//              the segments it touches. Writes leave a segment raw, it is
+//              compressed again once the object goes cold.
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache table
+
+const struct object_cache_intr zmemory_intr = {
+  .load         = zmemory_load,
+  .unload       = zmemory_unload,
+
+  .get_max      = zmemory_get_max,
+  .get_capacity = zmemory_get_capacity,
+
+  .create       = zmemory_create,
+  .read         = zmemory_read,
+  .write        = zmemory_write,
+  .destroy      = zmemory_destroy,
+  .compact      = zmemory_compact,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Cache memory counter
+
+static sem_t zmemory_stat_lock;
+
+static uint64_t zmemory_used = 0,
+                zmemory_logical = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Recently inflated segments
+
+static struct zmemory_inflated zmemory_inflated_list[ZMEMORY_INFLATED];
+
+static uint64_t zmemory_gen = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Initialization
+
+void zmemory_load(uint64_t cache_max, uint64_t cache_max_count) {
+  struct zmemory_inflated *inf;
+  uint32_t i;
+
+  sem_init(&zmemory_stat_lock, 0, 1);
+
+  for (i = 0; i < ZMEMORY_INFLATED; i++) {
+    inf = &zmemory_inflated_list[i];
+    if (!inf->data && !(inf->data = malloc(ZMEMORY_SEGMENT_SIZE)))
+      stderror("malloc");
+    inf->gen = 0;
+    sem_init(&inf->lock, 0, 1);
+  }
+}
+
+void zmemory_unload() {
+  uint64_t used, logical;
+
+  used = zmemory_get_capacity();
+  logical = zmemory_get_logical();
+  if (used)
+    notice("Compressed cache: %" PRIu64 " logical bytes in %" PRIu64
+           " physical bytes (%.2fx)", logical, used, (double) logical / used);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Memory maximums and capacity
+
+uint64_t zmemory_get_max() {
+  return ZMEMORY_DEFAULT_MAX;
+}
+
+uint64_t zmemory_get_capacity() {
+  uint64_t __zmemory_used;
+
+  sem_wait(&zmemory_stat_lock);
+  __zmemory_used = zmemory_used;
+  sem_post(&zmemory_stat_lock);
+
+  return __zmemory_used;
+}
+
+uint64_t zmemory_get_logical() {
+  uint64_t __zmemory_logical;
+
+  sem_wait(&zmemory_stat_lock);
+  __zmemory_logical = zmemory_logical;
+  sem_post(&zmemory_stat_lock);
+
+  return __zmemory_logical;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Cache operations
+
+struct object_cache *zmemory_create() {
+  struct zmemory_cache *zmem;
+
+  if (!(zmem = calloc(sizeof(*zmem), 1)))
+    stderror("calloc");
+  return (struct object_cache *) zmem;
+}
+
+int zmemory_read(struct object_cache *cache, uint32_t offt, char *buf,
+                 uint32_t *len) {
+  struct zmemory_cache *zmem;
+  uint32_t rlen, from, n;
+
+  zmem = (struct zmemory_cache *) cache;
+
+  if (offt >= zmem->len)
+    rlen = 0;
+  else
+    rlen = min(zmem->len - offt, *len);
+  *len = rlen;
+
+  while (rlen) {
+    from = offt % ZMEMORY_SEGMENT_SIZE;
+    n = min(rlen, ZMEMORY_SEGMENT_SIZE - from);
+
+    zmemory_segment_copy(&zmem->seg[offt / ZMEMORY_SEGMENT_SIZE], from,
+                         buf, n);
+
+    buf += n;
+    offt += n;
+    rlen -= n;
+  }
+  return SUCCESS;
+}
+
+int zmemory_write(struct object_cache *cache, uint32_t offt, const char *buf,
+                  uint32_t len) {
+  struct zmemory_cache *zmem;
+  struct zmemory_segment *seg;
+  int64_t used;
+  uint32_t from, n, old_len;
+
+  zmem = (struct zmemory_cache *) cache;
+
+  used = 0;
+  old_len = zmem->len;
+  while (len) {
+    seg = &zmem->seg[offt / ZMEMORY_SEGMENT_SIZE];
+    from = offt % ZMEMORY_SEGMENT_SIZE;
+    n = min(len, ZMEMORY_SEGMENT_SIZE - from);
+
+    // Written segments are hot, they stay raw until the object is compacted.
+    used += zmemory_segment_thaw(seg, max(seg->len, from + n));
+    memcpy(seg->data + from, buf, n);
+    seg->gen = __sync_add_and_fetch(&zmemory_gen, 1);
+    seg->cold = false;
+
+    buf += n;
+    offt += n;
+    len -= n;
+  }
+
+  zmem->len = max(zmem->len, offt);
+
+  sem_wait(&zmemory_stat_lock);
+  zmemory_used += used;
+  zmemory_logical += zmem->len - old_len;
+  sem_post(&zmemory_stat_lock);
+  return SUCCESS;
+}
+
+int zmemory_destroy(struct object_cache *cache) {
+  struct zmemory_cache *zmem;
+  uint64_t used;
+  uint32_t i;
+
+  zmem = (struct zmemory_cache *) cache;
+
+  used = 0;
+  for (i = 0; i < ZMEMORY_SEGMENTS; i++) {
+    if (zmem->seg[i].data) {
+      used += zmem->seg[i].zlen;
+      free(zmem->seg[i].data);
+    }
+  }
+
+  sem_wait(&zmemory_stat_lock);
+  assert(zmemory_used >= used && zmemory_logical >= zmem->len);
+  zmemory_used -= used;
+  zmemory_logical -= zmem->len;
+  sem_post(&zmemory_stat_lock);
+
+  free(zmem);
+  return SUCCESS;
+}
+
+int zmemory_compact(struct object_cache *cache) {
+  struct zmemory_cache *zmem;
+  struct zmemory_segment *seg;
+  int64_t used;
+  uint32_t i;
+
+  zmem = (struct zmemory_cache *) cache;
+
+  // Segments that did not shrink last time are not tried again until they
+  // are written.
+  used = 0;
+  for (i = 0; i < ZMEMORY_SEGMENTS; i++) {
+    seg = &zmem->seg[i];
+    if (seg->data && !seg->compressed && !seg->cold) {
+      used += zmemory_segment_store(seg, seg->data, seg->len);
+      seg->cold = true;
+    }
+  }
+
+  sem_wait(&zmemory_stat_lock);
+  zmemory_used += used;
+  sem_post(&zmemory_stat_lock);
+  return SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Segment compression
+
+void zmemory_segment_read(struct zmemory_segment *seg, char *buf) {
+  uLongf rlen;
+
+  if (!seg->data) {
+    rlen = 0;
+  } else if (!seg->compressed) {
+    memcpy(buf, seg->data, seg->len);
+    rlen = seg->len;
+  } else {
+    rlen = seg->len;
+    if (uncompress((Bytef*) buf, &rlen, (const Bytef*) seg->data,
+                   seg->zlen) != Z_OK || rlen != seg->len)
+      error("Compressed cache segment is corrupted");
+  }
+
+  memset(buf + rlen, 0, ZMEMORY_SEGMENT_SIZE - rlen);
+}
+
+void zmemory_segment_copy(struct zmemory_segment *seg, uint32_t from,
+                          char *buf, uint32_t len) {
+  struct zmemory_inflated *inf;
+  uint32_t n;
+
+  if (!seg->compressed) {
+    n = from < seg->len ? min(len, seg->len - from) : 0;
+    if (n)
+      memcpy(buf, seg->data + from, n);
+    memset(buf + n, 0, len - n);
+    return;
+  }
+
+  // Readers share the object lock, so the inflated copies are kept apart
+  // from the object and each has its own lock. Small sequential reads of a
+  // cold segment inflate it once.
+  inf = &zmemory_inflated_list[seg->gen % ZMEMORY_INFLATED];
+  sem_wait(&inf->lock);
+  if (inf->gen != seg->gen) {
+    zmemory_segment_read(seg, inf->data);
+    inf->gen = seg->gen;
+  }
+  memcpy(buf, inf->data + from, len);
+  sem_post(&inf->lock);
+}
+
+int64_t zmemory_segment_thaw(struct zmemory_segment *seg, uint32_t len) {
+  char *data;
+  uLongf rlen;
+  int64_t used;
+
+  if (seg->data && !seg->compressed && len <= seg->len)
+    return 0;
+
+  used = -(int64_t) seg->zlen;
+
+  // The raw segment is sized to what it holds and grows with writes.
+  if (seg->compressed) {
+    if (!(data = malloc(len)))
+      stderror("malloc");
+    rlen = seg->len;
+    if (uncompress((Bytef*) data, &rlen, (const Bytef*) seg->data,
+                   seg->zlen) != Z_OK || rlen != seg->len)
+      error("Compressed cache segment is corrupted");
+    free(seg->data);
+  } else if (!(data = realloc(seg->data, len))) {
+    stderror("realloc");
+  }
+  memset(data + seg->len, 0, len - seg->len);
+
+  seg->data = data;
+  seg->zlen = seg->len = len;
+  seg->compressed = false;
+  return used + len;
+}
+
+int64_t zmemory_segment_store(struct zmemory_segment *seg, const char *buf,
+                              uint32_t len) {
+  char *zbuf;
+  uLongf zlen;
+  int64_t used;
+
+  used = -(int64_t) seg->zlen;
+
+  zlen = compressBound(len);
+  if (!(zbuf = malloc(zlen)))
+    stderror("malloc");
+
+  // Speed matters more than ratio here, and segments that do not shrink
+  // are kept as they are.
+  if (compress2((Bytef*) zbuf, &zlen, (const Bytef*) buf, len,
+                Z_BEST_SPEED) == Z_OK && zlen < len) {
+    seg->compressed = true;
+  } else if (buf == seg->data) {
+    free(zbuf);
+    return 0;
+  } else {
+    memcpy(zbuf, buf, len);
+    zlen = len;
+    seg->compressed = false;
+  }
+
+  if (!(zbuf = realloc(zbuf, zlen)))
+    stderror("realloc");
+
+  if (seg->data)
+    free(seg->data);
+  seg->data = zbuf;
+  seg->zlen = zlen;
+  seg->len = len;
+
+  return used + zlen;
+}
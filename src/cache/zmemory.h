@@ -0,0 +1,87 @@
+/*
+ * cloudfs: zmemory header
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include <semaphore.h>
+#include "object.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define ZMEMORY_DEFAULT_MAX   (16 * 1024 * 1024)
+
+#define ZMEMORY_SEGMENT_SIZE  (256 * 1024)
+#define ZMEMORY_SEGMENTS      (OBJECT_MAX_SIZE / ZMEMORY_SEGMENT_SIZE)
+
+#define ZMEMORY_INFLATED      8
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache table
+
+extern const struct object_cache_intr zmemory_intr;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     List struct of cache data
+
+// Segments are written raw and only compressed once the object goes cold,
+// the generation changes with every write so inflated copies never go
+// stale.
+struct zmemory_segment {
+  char *data;
+  uint32_t zlen, len;
+  uint64_t gen;
+  bool compressed, cold;
+};
+
+struct zmemory_inflated {
+  char *data;
+  uint64_t gen;
+  sem_t lock;
+};
+
+struct zmemory_cache {
+  struct object_cache obj;
+  struct zmemory_segment seg[ZMEMORY_SEGMENTS];
+  uint32_t len;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Initialization
+
+void zmemory_load(uint64_t cache_max, uint64_t cache_max_count);
+void zmemory_unload();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Memory maximums and capacity
+
+uint64_t zmemory_get_max();
+uint64_t zmemory_get_capacity();
+uint64_t zmemory_get_logical();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Cache operations
+
+struct object_cache *zmemory_create();
+int zmemory_read(struct object_cache *cache, uint32_t offt, char *buf,
+                 uint32_t *len);
+int zmemory_write(struct object_cache *cache, uint32_t offt, const char *buf,
+                  uint32_t len);
+int zmemory_destroy(struct object_cache *cache);
+int zmemory_compact(struct object_cache *cache);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Segment compression
+
+void zmemory_segment_read(struct zmemory_segment *seg, char *buf);
+void zmemory_segment_copy(struct zmemory_segment *seg, uint32_t from,
+                          char *buf, uint32_t len);
+int64_t zmemory_segment_thaw(struct zmemory_segment *seg, uint32_t len);
+int64_t zmemory_segment_store(struct zmemory_segment *seg, const char *buf,
+                              uint32_t len);
@@ -141,9 +141,24 @@ bool crypt_has_cipher() {
 
 bool crypt_enc(const char *in_buf, uint32_t in_len, char **out_buf,
                uint32_t *out_len) {
+  char *out_rbuf;
+
+  if (!(out_rbuf = malloc(crypt_bound(in_len))))
+    stderror("malloc");
+
+  if (!crypt_enc_into(in_buf, in_len, out_rbuf, out_len)) {
+    free(out_rbuf);
+    return false;
+  }
+
+  *out_buf = out_rbuf;
+  return true;
+}
+
+bool crypt_enc_into(const char *in_buf, uint32_t in_len, char *out_buf,
+                    uint32_t *out_len) {
   EVP_CIPHER_CTX ctx;
   uint8_t iv[CRYPT_IV_SIZE];
-  char *out_rbuf;
   int32_t out_rlen, out_flen;
 
   if (!crypt_cipher_enabled) {
@@ -171,36 +186,35 @@ bool crypt_enc(const char *in_buf, uint32_t in_len, char **out_buf,
     return false;
   }
 
-  if (!(out_rbuf = malloc(sizeof(iv) + in_len + crypt_blocksize)))
-    stderror("malloc");
-  memcpy(out_rbuf, iv, sizeof(iv));
+  memcpy(out_buf, iv, sizeof(iv));
   out_rlen = sizeof(iv);
 
-  if (!EVP_EncryptUpdate(&ctx, (uint8_t*) out_rbuf + out_rlen, &out_flen,
+  if (!EVP_EncryptUpdate(&ctx, (uint8_t*) out_buf + out_rlen, &out_flen,
              (uint8_t*) in_buf, in_len)) {
     warning("EVP_EncryptUpdate failed");
-    free(out_rbuf);
     EVP_CIPHER_CTX_cleanup(&ctx);
     return false;
   }
   out_rlen += out_flen;
 
-  if (!EVP_EncryptFinal_ex(&ctx, (uint8_t*) out_rbuf + out_rlen, &out_flen)) {
+  if (!EVP_EncryptFinal_ex(&ctx, (uint8_t*) out_buf + out_rlen, &out_flen)) {
     warning("EVP_EncryptFinal_ex failed");
-    free(out_rbuf);
     EVP_CIPHER_CTX_cleanup(&ctx);
     return false;
   }
   out_rlen += out_flen;
 
   assert(out_rlen >= 0);
-  *out_buf = out_rbuf;
   *out_len = out_rlen;
 
   EVP_CIPHER_CTX_cleanup(&ctx);
   return true;
 }
 
+uint32_t crypt_bound(uint32_t len) {
+  return CRYPT_IV_SIZE + len + crypt_blocksize;
+}
+
 bool crypt_dec(const char *in_buf, uint32_t in_len, char **out_buf,
                uint32_t *out_len, bool suppress_error) {
   EVP_CIPHER_CTX ctx;
@@ -43,5 +43,8 @@ bool crypt_keycheck_test(char *keycheck, uint32_t size);
 bool crypt_has_cipher();
 bool crypt_enc(const char *in_buf, uint32_t in_len, char **out_buf,
                uint32_t *out_len);
+bool crypt_enc_into(const char *in_buf, uint32_t in_len, char *out_buf,
+                    uint32_t *out_len);
+uint32_t crypt_bound(uint32_t len);
 bool crypt_dec(const char *in_buf, uint32_t in_len, char **out_buf,
                uint32_t *out_len, bool suppress_error);
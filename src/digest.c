@@ -0,0 +1,185 @@
+/*
+ * cloudfs: digest source
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+#include <openssl/md5.h>
+#include "config.h"
+#include "log.h"
+#include "misc.h"
+#include "digest.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class:       digest
+// Description: Digests stored in front of every object, used to skip the
+//              upload of an object whose contents did not change. Objects
+//              written with one digest are readable with any other, a
+//              mismatch only costs one upload.
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Available digests
+
+static const struct digest_intr_opt digest_intr_opt_list[] = {
+  {   "md5", digest_md5   },
+  { "xxh64", digest_xxh64 },
+};
+
+static void (*digest_func)(const char *, uint32_t, char *) = digest_xxh64;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Digest initialization
+
+void digest_load() {
+  const struct digest_intr_opt *opt, *opt_end;
+  const char *digest;
+
+  if (DIGEST_LENGTH != MD5_DIGEST_LENGTH)
+    error("MD5 digest length does not match that of OpenSSL");
+
+  if (!(digest = config_get("digest")))
+    digest = "xxh64";
+
+  digest_func = NULL;
+  for (opt = digest_intr_opt_list,
+       opt_end = opt + sizearr(digest_intr_opt_list);
+       opt < opt_end;
+       opt++) {
+    if (!strcasecmp(digest, opt->name)) {
+      digest_func = opt->func;
+      break;
+    }
+  }
+
+  if (!digest_func)
+    error("Invalid digest specified \"%s\"", digest);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Digest computation
+
+void digest_compute(const char *buf, uint32_t len, char *out) {
+  digest_func(buf, len, out);
+}
+
+uint64_t digest_segment(const char *buf, uint32_t len) {
+  char out[DIGEST_LENGTH];
+  uint64_t h;
+
+  digest_func(buf, len, out);
+  memcpy(&h, out, sizeof(h));
+  return h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Available digests
+
+void digest_md5(const char *buf, uint32_t len, char *out) {
+  MD5((const uint8_t*) buf, len, (uint8_t*) out);
+}
+
+void digest_xxh64(const char *buf, uint32_t len, char *out) {
+  uint64_t h;
+
+  // The tag fills the rest of the field, so the digest can never equal an
+  // MD5 left by an older version and the upload is not skipped by mistake.
+  h = htole64(digest_xxh64_hash(buf, len, 0));
+  memcpy(out, &h, sizeof(h));
+  memcpy(out + sizeof(h), DIGEST_XXH64_TAG, DIGEST_LENGTH - sizeof(h));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     xxHash64
+
+static inline uint64_t digest_rotl(uint64_t x, uint32_t r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t digest_read64(const char *p) {
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return le64toh(v);
+}
+
+static inline uint32_t digest_read32(const char *p) {
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return le32toh(v);
+}
+
+static inline uint64_t digest_round(uint64_t acc, uint64_t input) {
+  acc += input * DIGEST_XXH64_PRIME2;
+  acc = digest_rotl(acc, 31);
+  return acc * DIGEST_XXH64_PRIME1;
+}
+
+static inline uint64_t digest_merge(uint64_t acc, uint64_t val) {
+  acc ^= digest_round(0, val);
+  return acc * DIGEST_XXH64_PRIME1 + DIGEST_XXH64_PRIME4;
+}
+
+uint64_t digest_xxh64_hash(const char *buf, uint64_t len, uint64_t seed) {
+  const char *end, *limit;
+  uint64_t h, v1, v2, v3, v4;
+
+  end = buf + len;
+
+  if (len >= 32) {
+    limit = end - 32;
+    v1 = seed + DIGEST_XXH64_PRIME1 + DIGEST_XXH64_PRIME2;
+    v2 = seed + DIGEST_XXH64_PRIME2;
+    v3 = seed;
+    v4 = seed - DIGEST_XXH64_PRIME1;
+
+    // Four independent lanes keep the multipliers busy, this loop is where
+    // nearly all of the time goes for a full object.
+    do {
+      v1 = digest_round(v1, digest_read64(buf));
+      v2 = digest_round(v2, digest_read64(buf + 8));
+      v3 = digest_round(v3, digest_read64(buf + 16));
+      v4 = digest_round(v4, digest_read64(buf + 24));
+      buf += 32;
+    } while (buf <= limit);
+
+    h = digest_rotl(v1, 1) + digest_rotl(v2, 7) +
+        digest_rotl(v3, 12) + digest_rotl(v4, 18);
+    h = digest_merge(h, v1);
+    h = digest_merge(h, v2);
+    h = digest_merge(h, v3);
+    h = digest_merge(h, v4);
+  } else {
+    h = seed + DIGEST_XXH64_PRIME5;
+  }
+
+  h += len;
+
+  for (; buf + 8 <= end; buf += 8) {
+    h ^= digest_round(0, digest_read64(buf));
+    h = digest_rotl(h, 27) * DIGEST_XXH64_PRIME1 + DIGEST_XXH64_PRIME4;
+  }
+
+  if (buf + 4 <= end) {
+    h ^= (uint64_t) digest_read32(buf) * DIGEST_XXH64_PRIME1;
+    h = digest_rotl(h, 23) * DIGEST_XXH64_PRIME2 + DIGEST_XXH64_PRIME3;
+    buf += 4;
+  }
+
+  for (; buf < end; buf++) {
+    h ^= (uint8_t) *buf * DIGEST_XXH64_PRIME5;
+    h = digest_rotl(h, 11) * DIGEST_XXH64_PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= DIGEST_XXH64_PRIME2;
+  h ^= h >> 29;
+  h *= DIGEST_XXH64_PRIME3;
+  h ^= h >> 32;
+  return h;
+}
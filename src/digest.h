@@ -0,0 +1,56 @@
+/*
+ * cloudfs: digest header
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include <stdint.h>
+#include <stdbool.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define DIGEST_LENGTH         16
+
+#define DIGEST_XXH64_PRIME1   0x9e3779b185ebca87ULL
+#define DIGEST_XXH64_PRIME2   0xc2b2ae3d27d4eb4fULL
+#define DIGEST_XXH64_PRIME3   0x165667b19e3779f9ULL
+#define DIGEST_XXH64_PRIME4   0x85ebca77c2b2ae63ULL
+#define DIGEST_XXH64_PRIME5   0x27d4eb2f165667c5ULL
+
+#define DIGEST_XXH64_TAG      "xxh64\0\0\0"
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Digest table
+
+struct digest_intr_opt {
+  const char *name;
+  void (*func)(const char *buf, uint32_t len, char *out);
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Digest initialization
+
+void digest_load();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Digest computation
+
+void digest_compute(const char *buf, uint32_t len, char *out);
+uint64_t digest_segment(const char *buf, uint32_t len);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Available digests
+
+void digest_md5(const char *buf, uint32_t len, char *out);
+void digest_xxh64(const char *buf, uint32_t len, char *out);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     xxHash64
+
+uint64_t digest_xxh64_hash(const char *buf, uint64_t len, uint64_t seed);
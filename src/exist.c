@@ -0,0 +1,302 @@
+/*
+ * cloudfs: exist source
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <semaphore.h>
+#include <inttypes.h>
+#include "config.h"
+#include "log.h"
+#include "misc.h"
+#include "bucket.h"
+#include "volume.h"
+#include "exist.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class:       exist
+// Description: Index of the chunks that exist in the store, so reads of
+//              chunks that were never written are answered without a request.
+//              The invariant is that a bit may be set spuriously, but is
+//              never cleared spuriously: a false positive costs a request,
+//              a false negative loses data. Every entry counts the uploads
+//              in flight and stamps the last one to start, and a delete
+//              only clears its bit if no upload overlapped it.
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index hashmap
+
+static struct exist_entry **exist_hmap = NULL;
+
+static uint32_t exist_hmap_size = 0,
+                exist_hmap_count = 0;
+
+static sem_t exist_lock;
+
+static uint64_t exist_stamp = 0;
+
+static bool exist_enabled = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index counters
+
+static uint64_t exist_objects = 0,
+                exist_skipped = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index construction / destruction
+
+void exist_load() {
+  if (!config_get("existence-index"))
+    return;
+
+  sem_init(&exist_lock, 0, 1);
+
+  exist_hmap_size = EXIST_MIN_HMAP;
+  exist_hmap_count = 0;
+  if (!(exist_hmap = calloc(exist_hmap_size, sizeof(*exist_hmap))))
+    stderror("calloc");
+
+  exist_objects = 0;
+  exist_skipped = 0;
+
+  if (!exist_build()) {
+    warning("Unable to list every object of the volume, the existence index "
+            "is disabled");
+    exist_unload();
+    return;
+  }
+
+  exist_enabled = true;
+  notice("Existence index holds %" PRIu64 " objects", exist_objects);
+}
+
+void exist_unload() {
+  struct exist_entry *p, *next;
+  uint32_t i;
+
+  if (!exist_hmap)
+    return;
+
+  if (exist_enabled)
+    notice("Existence index skipped %" PRIu64 " requests", exist_skipped);
+  exist_enabled = false;
+
+  for (i = 0; i < exist_hmap_size; i++) {
+    for (p = exist_hmap[i]; p; p = next) {
+      next = p->next;
+      free(p);
+    }
+  }
+  free(exist_hmap);
+  exist_hmap = NULL;
+  exist_hmap_size = 0;
+  exist_hmap_count = 0;
+
+  sem_destroy(&exist_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index construction
+
+bool exist_build() {
+  char prefix[VOLUME_OBJECT_STRING_MAX];
+  uint32_t prefix_len;
+
+  snprintf(prefix, sizeof(prefix), VOLUME_OBJECT_PREFIX "%s.",
+           volume_get_selected());
+  prefix_len = strlen(prefix);
+
+  // A listing that fails part way would leave a partial index that hides
+  // objects, so any error disables the index.
+  return store_scan(bucket_get_selected(), prefix, VOLUME_OBJECT_ALPHABET,
+                    EXIST_LIST_PAGE, exist_build_page,
+                    (void*) (uintptr_t) prefix_len) == SUCCESS;
+}
+
+int exist_build_page(struct store_list *page, void *arg) {
+  struct volume_object object;
+  uint32_t i, prefix_len;
+
+  prefix_len = (uintptr_t) arg;
+  for (i = 0; i < page->size; i++) {
+    if (sscanf(page->item[i] + prefix_len, "%" SCNx64 ".%" SCNx64,
+               &object.index, &object.chunk) == 2) {
+      exist_set(object);
+      __sync_add_and_fetch(&exist_objects, 1);
+    }
+  }
+  return SUCCESS;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index lookup and update
+
+bool exist_query(struct volume_object object) {
+  struct exist_entry *p;
+  bool found;
+
+  if (!exist_enabled)
+    return true;
+
+  sem_wait(&exist_lock);
+  p = exist_hmap_lookup(object.index, object.chunk >> EXIST_BITS_LOG2);
+  found = (p && (p->bits & (1ULL << (object.chunk & (EXIST_BITS - 1)))));
+  if (!found)
+    exist_skipped++;
+  sem_post(&exist_lock);
+
+  return found;
+}
+
+struct exist_entry *exist_entry_get(struct volume_object object) {
+  struct exist_entry *p, **head;
+  uint64_t base;
+
+  base = object.chunk >> EXIST_BITS_LOG2;
+  if (!(p = exist_hmap_lookup(object.index, base))) {
+    if (!(p = calloc(sizeof(*p), 1)))
+      stderror("calloc");
+    p->index = object.index;
+    p->base = base;
+
+    head = exist_hmap_head(object.index, base);
+    p->next = *head;
+    *head = p;
+
+    if (++exist_hmap_count > exist_hmap_size)
+      exist_hmap_resize(exist_hmap_size << 1);
+  }
+  p->bits |= 1ULL << (object.chunk & (EXIST_BITS - 1));
+  return p;
+}
+
+void exist_set(struct volume_object object) {
+  if (!exist_hmap)
+    return;
+
+  sem_wait(&exist_lock);
+  exist_entry_get(object);
+  sem_post(&exist_lock);
+}
+
+void exist_put_begin(struct volume_object object) {
+  struct exist_entry *p;
+
+  if (!exist_hmap)
+    return;
+
+  // The bit is set before the request is sent, and stays set until the
+  // upload has finished, whatever deletes complete in the meantime.
+  sem_wait(&exist_lock);
+  p = exist_entry_get(object);
+  p->pending++;
+  p->stamp = ++exist_stamp;
+  sem_post(&exist_lock);
+}
+
+void exist_put_end(struct volume_object object) {
+  struct exist_entry *p;
+
+  if (!exist_hmap)
+    return;
+
+  // A failed upload may still have reached the store, so the bit is kept
+  // either way.
+  sem_wait(&exist_lock);
+  p = exist_entry_get(object);
+  p->pending--;
+  sem_post(&exist_lock);
+}
+
+uint64_t exist_delete_begin() {
+  uint64_t stamp;
+
+  if (!exist_hmap)
+    return 0;
+
+  sem_wait(&exist_lock);
+  stamp = exist_stamp;
+  sem_post(&exist_lock);
+  return stamp;
+}
+
+void exist_clear(struct volume_object object, uint64_t stamp) {
+  struct exist_entry *p, **head;
+  uint64_t base;
+
+  if (!exist_hmap)
+    return;
+
+  base = object.chunk >> EXIST_BITS_LOG2;
+
+  // An upload that started after the delete was sent may have been applied
+  // after it, so the bit is only cleared when none overlapped. The check is
+  // per entry, which keeps neighbouring chunks set a little longer at worst.
+  sem_wait(&exist_lock);
+  for (head = exist_hmap_head(object.index, base); (p = *head);
+       head = &p->next) {
+    if (p->index != object.index || p->base != base)
+      continue;
+    if (p->pending || p->stamp > stamp)
+      break;
+
+    p->bits &= ~(1ULL << (object.chunk & (EXIST_BITS - 1)));
+    if (!p->bits) {
+      *head = p->next;
+      exist_hmap_count--;
+      free(p);
+    }
+    break;
+  }
+  sem_post(&exist_lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index hashmap
+
+struct exist_entry **exist_hmap_head(uint64_t index, uint64_t base) {
+  uint64_t h;
+
+  h = (index * 0x9e3779b97f4a7c15ULL) ^ base;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return &exist_hmap[h & (exist_hmap_size - 1)];
+}
+
+struct exist_entry *exist_hmap_lookup(uint64_t index, uint64_t base) {
+  struct exist_entry *p;
+
+  for (p = *exist_hmap_head(index, base); p; p = p->next) {
+    if (p->index == index && p->base == base)
+      return p;
+  }
+  return NULL;
+}
+
+void exist_hmap_resize(uint32_t size) {
+  struct exist_entry **hmap, **head, *p, *next;
+  uint32_t old_size, i;
+
+  hmap = exist_hmap;
+  old_size = exist_hmap_size;
+
+  if (!(exist_hmap = calloc(size, sizeof(*exist_hmap))))
+    stderror("calloc");
+  exist_hmap_size = size;
+
+  for (i = 0; i < old_size; i++) {
+    for (p = hmap[i]; p; p = next) {
+      next = p->next;
+
+      head = exist_hmap_head(p->index, p->base);
+      p->next = *head;
+      *head = p;
+    }
+  }
+  free(hmap);
+}
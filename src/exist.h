@@ -0,0 +1,62 @@
+/*
+ * cloudfs: exist header
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "volume.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define EXIST_MIN_HMAP      256
+#define EXIST_BITS_LOG2     6
+#define EXIST_BITS          (1 << EXIST_BITS_LOG2)
+
+#define EXIST_LIST_PAGE     1000
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index entry, a bitmap of consecutive chunks
+
+struct exist_entry {
+  uint64_t index, base, bits, stamp;
+  uint32_t pending;
+  struct exist_entry *next;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index initialization
+
+void exist_load();
+void exist_unload();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index construction
+
+bool exist_build();
+int exist_build_page(struct store_list *page, void *arg);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index lookup and update
+
+bool exist_query(struct volume_object object);
+struct exist_entry *exist_entry_get(struct volume_object object);
+void exist_set(struct volume_object object);
+void exist_put_begin(struct volume_object object);
+void exist_put_end(struct volume_object object);
+uint64_t exist_delete_begin();
+void exist_clear(struct volume_object object, uint64_t stamp);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Index hashmap
+
+struct exist_entry **exist_hmap_head(uint64_t index, uint64_t base);
+struct exist_entry *exist_hmap_lookup(uint64_t index, uint64_t base);
+void exist_hmap_resize(uint32_t size);
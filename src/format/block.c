@@ -29,6 +29,7 @@
 #include "object.h"
 #include "store.h"
 #include "misc.h"
+#include "readahead.h"
 #include "format/block.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -52,6 +53,10 @@ static int32_t block_nbd_fd = -1, block_nbd_dev = -1;
 
 static uint32_t block_nbd_port = 0;
 
+static uint64_t block_capacity = 0;
+
+static struct readahead_stream block_readahead;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Connect to nbd
 
@@ -66,6 +71,7 @@ void block_mount(const struct volume_metadata *md, const char *path) {
           BLOCK_NBD_SIZE);
 
   blocks = (md->capacity >> BLOCK_NBD_SIZE_LOG2);
+  block_capacity = md->capacity;
 
   if ((block_nbd_dev = open(path, O_RDWR)) < 0)
     error("Unable to open nbd device %s, "
@@ -88,6 +94,7 @@ void block_mount(const struct volume_metadata *md, const char *path) {
 
   block_disconnect();
   object_unload();
+  store_unload();
 }
 
 void block_unmount(const struct volume_metadata *md, const char *path) {
@@ -378,6 +385,8 @@ int block_nbd_commit_object(uint32_t type, char *p_buf, uint32_t p_len,
     object.chunk = ident;
     switch (type) {
       case NBD_CMD_READ:
+        readahead_access(&block_readahead, object,
+                         (block_capacity - 1) >> OBJECT_MAX_SIZE_LOG2);
         if ((ret = object_read(object, offt, p_buf, nlen, NULL)) != SUCCESS) {
           if (ret == NOT_FOUND) {
             memset(p_buf, 0, nlen);
@@ -107,6 +107,7 @@ void vfs_mount(const struct volume_metadata *md, const char *path) {
   vfs_fd_clear();
   vfs_node_clear();
   object_unload();
+  store_unload();
 }
 
 void vfs_unmount(const struct volume_metadata *md, const char *path) {
@@ -430,9 +431,10 @@ void vfs_node_ref(struct vfs_inode *node) {
 }
 
 void vfs_node_purge_contents(struct vfs_inode *node) {
-  struct volume_object object;
+  struct volume_object object, *list;
   struct vfs_inode_ptr last_ptr;
   uint64_t max_chunk;
+  uint32_t count;
 
   object.index = node->data.ino;
   object.chunk = 0;
@@ -448,13 +450,21 @@ void vfs_node_purge_contents(struct vfs_inode *node) {
     max_chunk = node->data.last_block >> OBJECT_MAX_SIZE_LOG2;
   }
 
+  if (!(list = malloc(VFS_PURGE_BATCH * sizeof(*list))))
+    stderror("malloc");
+
   while (object.chunk <= max_chunk) {
-    if (object_delete(object) != SUCCESS) {
+    for (count = 0; count < VFS_PURGE_BATCH && object.chunk <= max_chunk;
+         count++, object.chunk++)
+      list[count] = object;
+
+    if (object_delete_list(list, count) != SUCCESS) {
       warning("Delete error on inode %016" PRIx64, object.index);
       break;
     }
-    object.chunk++;
   }
+
+  free(list);
 }
 
 void vfs_node_deref(struct vfs_inode *node) {
@@ -591,6 +601,8 @@ int vfs_io_perform(struct vfs_inode *node, enum vfs_io_type type, char *buf,
     object.chunk = chunk;
     switch (type) {
       case VFS_IO_READ:
+        readahead_access(&node->ra, object, node->data.size ?
+                         (node->data.size - 1) >> OBJECT_MAX_SIZE_LOG2 : 0);
         if ((ret = object_read(object, offt, buf, nlen, NULL)) != SUCCESS) {
           if (ret == NOT_FOUND) {
             memset(buf, 0, nlen);
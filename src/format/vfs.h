@@ -14,6 +14,7 @@
 #include <sys/stat.h>
 #include <fuse.h>
 #include "volume.h"
+#include "readahead.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Macros
@@ -26,6 +27,8 @@
 #define VFS_FAKE_BLOCK_SIZE   4096
 #define VFS_FAKE_REPORT_SIZE  512
 
+#define VFS_PURGE_BATCH       1000
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Format table
 
@@ -58,6 +61,7 @@ struct vfs_inode {
   uint32_t refcount;
   struct vfs_inode_data data;
   struct vfs_inode_ptr ptr;
+  struct readahead_stream ra;
   struct vfs_inode *prev, *next;
 };
 
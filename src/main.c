@@ -51,9 +51,29 @@ static struct option opt_field[] = {
   { "norandom",            0,  NULL,  OPT_NRML    },
   { "force",               0,  NULL,  OPT_NRML    },
   { "use-https",           0,  NULL,  OPT_NRML    },
+  { "curl-pool-size",      1,  NULL,  OPT_NRML    },
+  { "curl-idle-timeout",   1,  NULL,  OPT_NRML    },
+  { "store-async-threads", 1,  NULL,  OPT_NRML    },
+  { "hedge-percentile",    1,  NULL,  OPT_NRML    },
+  { "hedge-budget",        1,  NULL,  OPT_NRML    },
 
   { "cache-type",          1,  NULL,  OPT_NRML    },
   { "cache-max",           1,  NULL,  OPT_NRML    },
+  { "cache-policy",        1,  NULL,  OPT_NRML    },
+  { "cache-file",          1,  NULL,  OPT_NRML    },
+  { "cache-index",         1,  NULL,  OPT_NRML    },
+  { "cache-persist",       0,  NULL,  OPT_NRML    },
+  { "cache-l2-type",       1,  NULL,  OPT_NRML    },
+  { "cache-l2-max",        1,  NULL,  OPT_NRML    },
+  { "memory-hugepages",    0,  NULL,  OPT_NRML    },
+  { "flush-threads",       1,  NULL,  OPT_NRML    },
+  { "dirty-background-ratio", 1, NULL, OPT_NRML    },
+  { "dirty-ratio",         1,  NULL,  OPT_NRML    },
+  { "dirty-expire",        1,  NULL,  OPT_NRML    },
+  { "readahead",           1,  NULL,  OPT_NRML    },
+  { "readahead-threads",   1,  NULL,  OPT_NRML    },
+  { "existence-index",     0,  NULL,  OPT_NRML    },
+  { "digest",              1,  NULL,  OPT_NRML    },
 
   { "create-bucket",       0,  NULL,  OPT_EXCL    },
   { "auto-create-bucket",  0,  NULL,  OPT_NRML    },
@@ -105,12 +125,35 @@ void usage() {
   fprintf(stderr, "\t%-25s Do not use /dev/random\n",           "--norandom");
   fprintf(stderr, "\t%-25s Force mounting volume\n",            "--force");
   fprintf(stderr, "\t%-25s Use HTTPS for storage requests\n",   "--use-https");
+  fprintf(stderr, "\t%-25s Idle connections kept open\n",       "--curl-pool-size [num]");
+  fprintf(stderr, "\t%-25s Seconds to keep idle connections\n", "--curl-idle-timeout [sec]");
+  fprintf(stderr, "\t%-25s Threads for blocking async requests\n", "--store-async-threads [num]");
+  fprintf(stderr, "\t%-25s Resend reads slower than this percentile\n", "--hedge-percentile [pct]");
+  fprintf(stderr, "\t%-25s Most extra reads in percent, default 5\n", "--hedge-budget [pct]");
   fprintf(stderr, "\n");
   fprintf(stderr, "Cache Arguments:\n");
   fprintf(stderr, "\t%-25s Cache type, must be one of:\n",      "--cache-type [type]");
-  fprintf(stderr, "\t%-25s     memory, file\n",                 "");
+  fprintf(stderr, "\t%-25s     memory, zmemory, file\n",        "");
   fprintf(stderr, "\t%-25s Maximum size of cache\n",            "--cache-max [size]");
+  fprintf(stderr, "\t%-25s Second cache tier, one of:\n",       "--cache-l2-type [type]");
+  fprintf(stderr, "\t%-25s     memory, zmemory, file\n",        "");
+  fprintf(stderr, "\t%-25s Maximum size of second tier\n",      "--cache-l2-max [size]");
   fprintf(stderr, "\t%-25s Path to store cache\n",              "--cache-path [path]");
+  fprintf(stderr, "\t%-25s Single cache file or device\n",       "--cache-file [path]");
+  fprintf(stderr, "\t%-25s Keep cache file across mounts\n",     "--cache-persist");
+  fprintf(stderr, "\t%-25s Index for a persistent cache\n",      "--cache-index [path]");
+  fprintf(stderr, "\t%-25s Cache replacement policy, one of:\n", "--cache-policy [type]");
+  fprintf(stderr, "\t%-25s     lru, 2q\n",                      "");
+  fprintf(stderr, "\t%-25s Back memory cache with huge pages\n", "--memory-hugepages");
+  fprintf(stderr, "\t%-25s Number of cache flush threads\n",    "--flush-threads [num]");
+  fprintf(stderr, "\t%-25s Dirty %% of cache to start flushing\n", "--dirty-background-ratio [pct]");
+  fprintf(stderr, "\t%-25s Dirty %% of cache to block writers\n", "--dirty-ratio [pct]");
+  fprintf(stderr, "\t%-25s Seconds before dirty data is flushed\n", "--dirty-expire [sec]");
+  fprintf(stderr, "\t%-25s Maximum chunks to read ahead\n",     "--readahead [num]");
+  fprintf(stderr, "\t%-25s Number of readahead threads\n",      "--readahead-threads [num]");
+  fprintf(stderr, "\t%-25s Skip requests for unwritten chunks\n", "--existence-index");
+  fprintf(stderr, "\t%-25s Change detection digest, one of:\n", "--digest [type]");
+  fprintf(stderr, "\t%-25s     xxh64, md5\n",                   "");
   fprintf(stderr, "\n");
   fprintf(stderr, "Bucket operations:\n");
   fprintf(stderr, "\t%-25s Create bucket\n",                    "--create-bucket");
@@ -36,3 +36,35 @@ void misc_maybe_fork() {
   curl_global_init(CURL_GLOBAL_ALL);
 }
 
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Buffer scanning
+
+bool misc_is_zero(const char *buf, uint64_t len) {
+  const uint64_t *word;
+  uint64_t acc;
+  uint32_t i;
+
+  for (; len && ((uintptr_t) buf & (sizeof(*word) - 1)); buf++, len--) {
+    if (*buf)
+      return false;
+  }
+
+  // Whole blocks are folded together without branches, which the compiler
+  // turns into vector instructions, and only checked once per block.
+  word = (const uint64_t*) buf;
+  for (; len >= MISC_ZERO_BLOCK; word += MISC_ZERO_BLOCK / sizeof(*word),
+                                 len -= MISC_ZERO_BLOCK) {
+    acc = 0;
+    for (i = 0; i < MISC_ZERO_BLOCK / sizeof(*word); i++)
+      acc |= word[i];
+    if (acc)
+      return false;
+  }
+
+  for (buf = (const char*) word; len; buf++, len--) {
+    if (*buf)
+      return false;
+  }
+  return true;
+}
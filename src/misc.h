@@ -6,6 +6,11 @@
 
 #pragma once
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include <stdint.h>
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Macros
 
@@ -34,6 +39,11 @@
 #define TERABYTE  (GIGABYTE * 1024UL)
 #define PETABYTE  (TERABYTE * 1024UL)
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Buffer scanning
+
+#define MISC_ZERO_BLOCK  256
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Typedefs
 
@@ -46,3 +56,8 @@ typedef enum bool { false = 0, true = 1 } bool;
 
 void misc_maybe_fork();
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Buffer scanning
+
+bool misc_is_zero(const char *buf, uint64_t len);
+
@@ -12,15 +12,20 @@
 #include <pthread.h>
 #include <semaphore.h>
 #include <inttypes.h>
-#include <openssl/md5.h>
 #include "config.h"
 #include "log.h"
 #include "misc.h"
 #include "volume.h"
 #include "object.h"
 #include "trxlog.h"
+#include "exist.h"
+#include "digest.h"
+#include "readahead.h"
 #include "cache/memory.h"
+#include "cache/zmemory.h"
 #include "cache/file.h"
+#include "policy/lru.h"
+#include "policy/twoq.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Class:       object
@@ -30,94 +35,257 @@
 // Section:     Available object cache mediums
 
 static const struct object_cache_intr_opt object_cache_intr_opt_list[] = {
-  { "memory", &memory_intr },
-  {   "file", &file_intr   },
+  {  "memory", &memory_intr  },
+  { "zmemory", &zmemory_intr },
+  {    "file", &file_intr    },
 };
 
-static const struct object_cache_intr *object_cache_intr_ptr = NULL;
+static const struct object_cache_intr *object_cache_intr_ptr = NULL,
+                                     *object_cache_l2_intr_ptr = NULL;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Available replacement policies
+
+static const struct object_policy_intr_opt object_policy_intr_opt_list[] = {
+  {  "lru", &lru_intr  },
+  {   "2q", &twoq_intr },
+};
+
+static const struct object_policy_intr *object_policy_intr_ptr = NULL;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     List of cache data
 
-static struct object_cache *object_cache_lru_head = NULL,
-                           *object_cache_lru_tail = NULL,
-                           *object_cache_fsh_head = NULL,
-                           *object_cache_fsh_tail = NULL,
-                           *object_cache_hmap[OBJECT_MAX_HMAP] = { };
+static struct object_cache_shard object_cache_shard_list[OBJECT_CACHE_SHARDS];
 
-static sem_t object_cache_global_lock;
+static uint64_t object_cache_tick = 0;
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Cache thread
 
-static pthread_t object_cache_thread_id;
+static pthread_t *object_cache_thread_id = NULL;
+
+static uint32_t object_cache_thread_count = 0;
 
 static sem_t object_cache_thread_wake,
              object_cache_thread_flushed;
 
 static bool object_cache_thread_running = false;
 
+static uint32_t object_cache_thread_kicks = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Write-back limits
+
+static uint64_t object_cache_dirty_background = 0,
+                object_cache_dirty_limit = 0,
+                object_cache_dirty_throttled = 0,
+                object_cache_dirty_complete = 0;
+
+static uint32_t object_cache_dirty_expire = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Reclaim thread
+
+static pthread_t object_cache_reclaim_id;
+
+static sem_t object_cache_reclaim_wake,
+             object_cache_reclaim_done;
+
+static uint32_t object_cache_reclaim_waiters = 0;
+
+static bool object_cache_reclaim_running = false;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Cache memory limits
 
 static uint64_t object_cache_max = 0,
-                object_cache_count = 0;
+                object_cache_count = 0,
+                object_cache_dirty_count = 0,
+                object_cache_reserved = 0,
+                object_cache_max_count = 0;
 
-static sem_t object_cache_count_lock;
+static uint32_t object_cache_fsh_start = 0;
 
 ////////////////////////////////////////////////////////////////////////////////
-// Section:     Object construction / destruction
+// Section:     Second cache tier
 
-void object_load() {
-  const struct object_cache_intr_opt *opt, *opt_end;
-  const char *cache, *cmax;
+static struct object_cache_shard object_cache_l2;
+
+static uint64_t object_cache_l2_max = 0,
+                object_cache_l2_max_count = 0;
+
+// Objects held by the second tier, counting copies still being written or
+// read back, protected by the second tier lock.
+static uint64_t object_cache_l2_live = 0;
 
-  if (OBJECT_MD5_DIGEST_LENGTH != MD5_DIGEST_LENGTH)
-    error("MD5 digest length does not match that of OpenSSL");
+static uint64_t object_cache_l2_hits = 0,
+                object_cache_l2_misses = 0,
+                object_cache_l2_demotions = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Zero object elision
+
+// Digest kept for an object whose zeros were elided, no real digest of a
+// stored object matches it.
+static const char object_cache_zero_md5[OBJECT_MD5_DIGEST_LENGTH] = {
+  [0 ... OBJECT_MD5_DIGEST_LENGTH - 1] = (char) 0xff
+};
+
+static uint64_t object_cache_zero_elided = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Cache hit counters
 
-  sem_init(&object_cache_global_lock, 0, 1);
-  sem_init(&object_cache_count_lock, 0, 1);
+static uint64_t object_cache_hits = 0,
+                object_cache_misses = 0;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object construction / destruction
+
+void object_load() {
+  struct object_cache_shard *shard;
+  const char *cache;
+  uint32_t i;
+
+  if (OBJECT_MD5_DIGEST_LENGTH != DIGEST_LENGTH)
+    error("Object digest length does not match that of the digest");
+  if (OBJECT_SEGMENTS > sizeof(uint64_t) * 8)
+    error("Object segments do not fit the segment bitmap");
+
+  digest_load();
+
+  for (i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+    shard = &object_cache_shard_list[i];
+    shard->id = i;
+    sem_init(&shard->lock, 0, 1);
+
+    if (!shard->hmap) {
+      shard->hmap_size = OBJECT_MIN_HMAP;
+      if (!(shard->hmap = calloc(shard->hmap_size, sizeof(*shard->hmap))))
+        stderror("calloc");
+    }
+  }
 
   if (!(cache = config_get("cache-type")))
     cache = "memory";
 
+  if (!(object_cache_intr_ptr = object_cache_intr_get(cache)))
+    error("Invalid cache specified");
+
+  object_cache_limits(object_cache_intr_ptr, config_get("cache-max"),
+                      &object_cache_max, &object_cache_max_count);
+
+  exist_load();
+  object_load_policy();
+  object_load_l2();
+
+  // Dirty objects brought back by the medium are picked up by the flush
+  // threads as soon as they start.
+  if (object_cache_intr_ptr->restore)
+    object_cache_intr_ptr->restore();
+
+  object_load_thread();
+  object_load_reclaim();
+  readahead_load();
+}
+
+const struct object_cache_intr *object_cache_intr_get(const char *name) {
+  const struct object_cache_intr_opt *opt, *opt_end;
+
   for (opt = object_cache_intr_opt_list,
        opt_end = opt + sizearr(object_cache_intr_opt_list);
        opt < opt_end;
        opt++) {
-    if (!strcasecmp(cache, opt->name)) {
-      object_cache_intr_ptr = opt->intr;
-      break;
-    }
+    if (!strcasecmp(name, opt->name))
+      return opt->intr;
   }
+  return NULL;
+}
 
-  if (!object_cache_intr_ptr)
-    error("Invalid cache specified");
-
-  if (object_cache_intr_ptr->load)
-    object_cache_intr_ptr->load();
+void object_cache_limits(const struct object_cache_intr *intr,
+                         const char *cmax, uint64_t *max,
+                         uint64_t *max_count) {
+  uint64_t count;
 
-  if ((cmax = config_get("cache-max"))) {
-    volume_str_to_size(cmax, &object_cache_max);
+  if (cmax) {
+    volume_str_to_size(cmax, max);
   } else {
-    if (!object_cache_intr_ptr->get_max)
+    if (!intr->get_max)
       error("Must specify --cache-max for selected cache type");
 
-    object_cache_max = object_cache_intr_ptr->get_max();
-    if (object_cache_max < OBJECT_MAX_SIZE) {
-      char max_size[1 << 7];
+    *max = intr->get_max();
+  }
+
+  if (*max < OBJECT_MAX_SIZE) {
+    char max_size[1 << 7];
 
-      volume_size_to_str(OBJECT_MAX_SIZE, max_size, sizeof(max_size));
-      error("Cache max must be at minimum %s", max_size);
-    }
+    volume_size_to_str(OBJECT_MAX_SIZE, max_size, sizeof(max_size));
+    error("Cache max must be at minimum %s", max_size);
   }
 
-  object_load_thread();
+  // The entry limit follows the cache size, the medium is loaded afterwards
+  // so it can size itself from both.
+  count = *max / OBJECT_CACHE_ENTRY_SIZE;
+  *max_count = max(count, OBJECT_MIN_CACHE_COUNT);
+
+  if (intr->load)
+    intr->load(*max, *max_count);
+
+  if (intr->get_max_count) {
+    count = intr->get_max_count();
+    if (count < *max_count)
+      *max_count = count;
+  }
+}
+
+void object_load_l2() {
+  const char *cache;
+
+  if (!(cache = config_get("cache-l2-type")))
+    return;
+
+  if (!(object_cache_l2_intr_ptr = object_cache_intr_get(cache)))
+    error("Invalid second tier cache specified");
+
+  // Each medium keeps its state in globals, so the two tiers can not share
+  // one, and the second tier only ever holds clean copies.
+  if (object_cache_l2_intr_ptr == object_cache_intr_ptr)
+    error("Second tier cache must differ from --cache-type");
+  if (object_cache_l2_intr_ptr->persist && config_get("cache-persist"))
+    error("Second tier cache can not be persistent");
+
+  object_cache_limits(object_cache_l2_intr_ptr, config_get("cache-l2-max"),
+                      &object_cache_l2_max, &object_cache_l2_max_count);
+
+  sem_init(&object_cache_l2.lock, 0, 1);
+  if (!object_cache_l2.hmap) {
+    object_cache_l2.hmap_size = OBJECT_MIN_HMAP;
+    if (!(object_cache_l2.hmap = calloc(object_cache_l2.hmap_size,
+                                        sizeof(*object_cache_l2.hmap))))
+      stderror("calloc");
+  }
 }
 
 void object_load_thread() {
   pthread_attr_t pattr;
-  int ret;
+  const char *threads;
+  uint32_t i;
+
+  object_cache_thread_count = OBJECT_FLUSH_THREADS;
+  if ((threads = config_get("flush-threads"))) {
+    object_cache_thread_count = strtoul(threads, NULL, 10);
+    if (object_cache_thread_count < 1 ||
+        object_cache_thread_count > OBJECT_MAX_FLUSH_THREADS)
+      error("Flush threads must be between 1 and %d",
+            OBJECT_MAX_FLUSH_THREADS);
+  }
+
+  if (!(object_cache_thread_id = calloc(object_cache_thread_count,
+                                        sizeof(*object_cache_thread_id))))
+    stderror("calloc");
+
+  object_load_dirty();
 
   sem_init(&object_cache_thread_wake, 0, 0);
   sem_init(&object_cache_thread_flushed, 0, 0);
@@ -126,28 +294,116 @@ void object_load_thread() {
 
   pthread_attr_init(&pattr);
   pthread_attr_setstacksize(&pattr, OBJECT_THREAD_STACK_SIZE);
-  ret = pthread_create(&object_cache_thread_id, &pattr,
-                       (void *(*)(void*)) object_cache_thread, NULL);
+  for (i = 0; i < object_cache_thread_count; i++) {
+    if (pthread_create(&object_cache_thread_id[i], &pattr,
+                       (void *(*)(void*)) object_cache_thread, NULL) != 0)
+      error("Error creating cache thread");
+  }
   pthread_attr_destroy(&pattr);
+}
+
+void object_load_dirty() {
+  const char *background, *ratio, *expire;
+  uint32_t background_pct, ratio_pct;
+
+  background_pct = OBJECT_DIRTY_BACKGROUND;
+  if ((background = config_get("dirty-background-ratio")))
+    background_pct = strtoul(background, NULL, 10);
 
-  if (ret < 0)
-    error("Error creating cache thread");
+  ratio_pct = OBJECT_DIRTY_RATIO;
+  if ((ratio = config_get("dirty-ratio")))
+    ratio_pct = strtoul(ratio, NULL, 10);
+
+  if (!background_pct || background_pct > ratio_pct || ratio_pct > 100)
+    error("Dirty ratios must satisfy 0 < background <= ratio <= 100");
+
+  object_cache_dirty_expire = OBJECT_DIRTY_EXPIRE;
+  if ((expire = config_get("dirty-expire")))
+    object_cache_dirty_expire = strtoul(expire, NULL, 10);
+
+  // Limits are kept as object counts, every dirty object is taken to be a
+  // full chunk since its size is not known without asking the medium.
+  object_cache_dirty_background = max(object_cache_max * background_pct /
+                                      100 / OBJECT_MAX_SIZE, 1);
+  object_cache_dirty_limit = max(object_cache_max * ratio_pct /
+                                 100 / OBJECT_MAX_SIZE, 1);
 }
 
 void object_unload() {
+  readahead_unload();
+  object_unload_reclaim();
   object_unload_thread();
+  object_unload_policy();
+  object_unload_l2();
 
   if (object_cache_intr_ptr && object_cache_intr_ptr->unload)
     object_cache_intr_ptr->unload();
   object_cache_intr_ptr = NULL;
+
+  exist_unload();
+}
+
+void object_load_reclaim() {
+  pthread_attr_t pattr;
+
+  sem_init(&object_cache_reclaim_wake, 0, 0);
+  sem_init(&object_cache_reclaim_done, 0, 0);
+
+  object_cache_reclaim_running = true;
+
+  pthread_attr_init(&pattr);
+  pthread_attr_setstacksize(&pattr, OBJECT_THREAD_STACK_SIZE);
+  if (pthread_create(&object_cache_reclaim_id, &pattr,
+                     (void *(*)(void*)) object_cache_reclaim_thread,
+                     NULL) != 0)
+    error("Error creating reclaim thread");
+  pthread_attr_destroy(&pattr);
 }
 
 void object_unload_thread() {
+  uint32_t i;
+
   notice("Flushing cache...");
   if (object_cache_thread_running) {
     object_cache_thread_running = false;
-    sem_post(&object_cache_thread_wake);
-    pthread_join(object_cache_thread_id, NULL);
+    for (i = 0; i < object_cache_thread_count; i++)
+      sem_post(&object_cache_thread_wake);
+    for (i = 0; i < object_cache_thread_count; i++)
+      pthread_join(object_cache_thread_id[i], NULL);
+
+    free(object_cache_thread_id);
+    object_cache_thread_id = NULL;
+    object_cache_thread_count = 0;
+  }
+
+  if (object_cache_zero_elided)
+    notice("Zero objects elided: %" PRIu64, object_cache_zero_elided);
+  if (object_cache_dirty_complete)
+    notice("Complete objects written early: %" PRIu64,
+           object_cache_dirty_complete);
+  if (object_cache_dirty_throttled)
+    notice("Writers throttled on dirty data: %" PRIu64,
+           object_cache_dirty_throttled);
+}
+
+void object_unload_l2() {
+  if (!object_cache_l2_intr_ptr)
+    return;
+
+  notice("Cache second tier: %" PRIu64 " hits, %" PRIu64 " misses, "
+         "%" PRIu64 " demotions", object_cache_l2_hits,
+         object_cache_l2_misses, object_cache_l2_demotions);
+
+  if (object_cache_l2_intr_ptr->unload)
+    object_cache_l2_intr_ptr->unload();
+  object_cache_l2_intr_ptr = NULL;
+}
+
+void object_unload_reclaim() {
+  if (object_cache_reclaim_running) {
+    object_cache_reclaim_running = false;
+    sem_post(&object_cache_reclaim_wake);
+    pthread_join(object_cache_reclaim_id, NULL);
   }
 }
 
@@ -163,12 +419,20 @@ int object_read(struct volume_object object, uint32_t offt, char *buf,
   assert(offt + len <= OBJECT_MAX_SIZE);
 
   p = object_cache_create_and_aquire(object);
-  object_cache_lock(p);
+  object_cache_lock_shared(p);
 
+  // Reads of a present object share the lock, only fetching the object from
+  // the store needs it exclusively.
   if ((p->flag & OBJECT_CACHE_NOT_PRESENT) &&
       !trxlog_match(&p->trxlog, offt, len)) {
+    __sync_add_and_fetch(&object_cache_misses, 1);
+
+    object_cache_unlock(p);
+    object_cache_lock(p);
     if ((ret = object_cache_fulfill(p)) != SUCCESS)
       goto out;
+  } else {
+    __sync_add_and_fetch(&object_cache_hits, 1);
   }
 
   rlen = len;
@@ -182,8 +446,9 @@ int object_read(struct volume_object object, uint32_t offt, char *buf,
   ret = SUCCESS;
 
 out:
-  object_cache_lru_pushfront(p);
+  object_cache_touch(p);
   object_cache_unlock(p);
+  object_cache_unreserve(p);
   object_cache_release(p, 0);
   return ret;
 }
@@ -203,14 +468,35 @@ int object_write(struct volume_object object, uint32_t offt, const char *buf,
 
   if ((p->flag & OBJECT_CACHE_NOT_PRESENT))
     trxlog_add(&p->trxlog, offt, len);
+  object_cache_flag_clear(p, OBJECT_CACHE_COMPACT);
+  object_cache_segment_invalidate(p, offt, len);
   object_cache_mark_dirty(p);
 
+  // The record of the object is brought up to date by the reclaim thread,
+  // writes only mark that it changed.
+  object_cache_flag_set(p, OBJECT_CACHE_PERSIST);
+
+  // Objects grow with writes and a medium may keep written data in a larger
+  // form, the reclaimer should not wait for its timer.
+  if (object_cache_over(OBJECT_RECLAIM_HIGH))
+    sem_post(&object_cache_reclaim_wake);
+
+  // A write that ends the chunk and leaves all of it written is a streaming
+  // writer moving on, the chunk can go out without fetching anything first.
+  if (offt + len == OBJECT_MAX_SIZE &&
+      (p->flag & OBJECT_CACHE_NOT_PRESENT) &&
+      trxlog_match(&p->trxlog, 0, OBJECT_MAX_SIZE))
+    object_cache_mark_complete(p);
+
   ret = SUCCESS;
 
 out:
-  object_cache_lru_pushfront(p);
+  object_cache_touch(p);
   object_cache_unlock(p);
+  object_cache_unreserve(p);
   object_cache_release(p, 0);
+
+  object_cache_dirty_throttle();
   return ret;
 }
 
@@ -232,11 +518,13 @@ int object_delete(struct volume_object object) {
 
   if ((p = object_cache_lookup_and_acquire(object))) {
     in_cache = true;
+    object_cache_flag_set(p, OBJECT_CACHE_DELETED);
     object_cache_release(p, OBJECT_RELEASE_DESTROY |
                          OBJECT_RELEASE_FORCE);
   } else {
     in_cache = false;
   }
+  object_cache_l2_drop(object);
 
   if ((ret = volume_delete_object(object)) == NOT_FOUND) {
     if (in_cache)
@@ -245,6 +533,93 @@ int object_delete(struct volume_object object) {
   return ret;
 }
 
+int object_delete_list(const struct volume_object *object, uint32_t count) {
+  struct object_cache *p;
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    if ((p = object_cache_lookup_and_acquire(object[i]))) {
+      object_cache_flag_set(p, OBJECT_CACHE_DELETED);
+      object_cache_release(p, OBJECT_RELEASE_DESTROY |
+                           OBJECT_RELEASE_FORCE);
+    }
+    object_cache_l2_drop(object[i]);
+  }
+
+  // Unlike object_delete, objects that were never stored are not an error,
+  // the list usually spans holes in the file.
+  return volume_delete_objects(object, count);
+}
+
+int object_prefetch(struct volume_object object) {
+  struct object_cache *p;
+  int ret;
+
+  if ((p = object_cache_lookup_and_acquire(object))) {
+    object_cache_release(p, 0);
+    return SUCCESS;
+  }
+
+  p = object_cache_create_and_aquire(object);
+  object_cache_lock(p);
+
+  ret = object_cache_fulfill(p);
+
+  object_cache_unlock(p);
+  object_cache_unreserve(p);
+  object_cache_release(p, 0);
+  return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache limits
+
+uint64_t object_get_cache_max() {
+  return object_cache_max;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache policy
+
+void object_load_policy() {
+  const struct object_policy_intr_opt *opt, *opt_end;
+  const char *policy;
+
+  if (!(policy = config_get("cache-policy")))
+    policy = "lru";
+
+  object_policy_intr_ptr = NULL;
+  for (opt = object_policy_intr_opt_list,
+       opt_end = opt + sizearr(object_policy_intr_opt_list);
+       opt < opt_end;
+       opt++) {
+    if (!strcasecmp(policy, opt->name)) {
+      object_policy_intr_ptr = opt->intr;
+      break;
+    }
+  }
+
+  if (!object_policy_intr_ptr)
+    error("Invalid cache policy specified \"%s\"", policy);
+
+  if (object_policy_intr_ptr->load)
+    object_policy_intr_ptr->load(object_cache_max_count);
+}
+
+void object_unload_policy() {
+  uint64_t hits, misses;
+
+  hits = object_cache_hits;
+  misses = object_cache_misses;
+  if (hits + misses)
+    notice("Cache reads: %" PRIu64 " hits, %" PRIu64 " misses (%.1f%%)",
+           hits, misses, 100.0 * hits / (hits + misses));
+
+  if (object_policy_intr_ptr && object_policy_intr_ptr->unload)
+    object_policy_intr_ptr->unload();
+  object_policy_intr_ptr = NULL;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache creation
 
@@ -255,63 +630,123 @@ static inline bool object_equals(struct volume_object a,
 
 struct object_cache *object_cache_create_and_aquire(
     struct volume_object object) {
+  struct object_cache_shard *shard;
   struct object_cache *p;
 
-  object_cache_garbage_collect(OBJECT_MAX_SIZE);
+  if ((p = object_cache_lookup_and_acquire(object)))
+    return p;
+
+  // Only a miss takes up new space, and it only reserves it. Eviction is
+  // left to the reclaim thread.
+  object_cache_reserve();
 
-  sem_wait(&object_cache_global_lock);
+  shard = object_cache_shard_get(object);
+  sem_wait(&shard->lock);
 
-  for (p = *object_cache_hmap_head(object); p; p = p->hmap_next) {
+  for (p = *object_cache_hmap_head(shard, object); p; p = p->hmap_next) {
     if (object_equals(p->object, object)) {
       object_cache_acquire(p);
       break;
     }
   }
 
-  if (!p) {
+  if (p) {
+    __sync_sub_and_fetch(&object_cache_reserved, 1);
+  } else {
     if (!(p = object_cache_intr_ptr->create()))
       error("Cache creation failure");
 
     p->object = object;
+    p->shard = shard;
     p->refcount = 1;
-    p->flag = OBJECT_CACHE_NOT_PRESENT;
-    sem_init(&p->lock, 0, 1);
+    p->flag = OBJECT_CACHE_NOT_PRESENT | OBJECT_CACHE_RESERVED;
+    object_cache_lock_init(p);
 
-    sem_wait(&object_cache_count_lock);
-    object_cache_count++;
-    sem_post(&object_cache_count_lock);
+    __sync_add_and_fetch(&object_cache_count, 1);
 
-    object_cache_lru_link(p);
+    object_policy_intr_ptr->link(p);
     object_cache_hmap_link(p);
   }
 
-  sem_post(&object_cache_global_lock);
+  sem_post(&shard->lock);
   return p;
 }
 
+void object_cache_restore(struct object_cache *p) {
+  struct object_cache_shard *shard;
+
+  shard = object_cache_shard_get(p->object);
+
+  p->shard = shard;
+  p->refcount = 0;
+  p->flag &= OBJECT_CACHE_NOT_PRESENT | OBJECT_CACHE_DIRTY;
+  object_cache_lock_init(p);
+
+  sem_wait(&shard->lock);
+
+  __sync_add_and_fetch(&object_cache_count, 1);
+
+  object_policy_intr_ptr->link(p);
+  object_cache_hmap_link(p);
+  if ((p->flag & OBJECT_CACHE_DIRTY)) {
+    p->dtime = object_cache_now();
+    object_cache_fsh_link(p);
+    __sync_add_and_fetch(&object_cache_dirty_count, 1);
+  }
+
+  sem_post(&shard->lock);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache sharding
+
+uint64_t object_cache_hash(struct volume_object object) {
+  uint64_t h;
+
+  h = (object.index * 0x9e3779b97f4a7c15ULL) ^ object.chunk;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  return h;
+}
+
+struct object_cache_shard *object_cache_shard_get(struct volume_object object) {
+  return &object_cache_shard_list[object_cache_hash(object) %
+                                  OBJECT_CACHE_SHARDS];
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache hashmap linking
 
-struct object_cache **object_cache_hmap_head(struct volume_object object) {
-  return &object_cache_hmap[(object.index ^ object.chunk) % OBJECT_MAX_HMAP];
+struct object_cache **object_cache_hmap_head(struct object_cache_shard *shard,
+                                             struct volume_object object) {
+  // The low bits of the hash pick the shard, the table size is a power of
+  // two so the remaining bits index the bucket.
+  return &shard->hmap[(object_cache_hash(object) / OBJECT_CACHE_SHARDS) &
+                      (shard->hmap_size - 1)];
 }
 
 void object_cache_hmap_link(struct object_cache *p) {
+  struct object_cache_shard *shard;
   struct object_cache **head;
 
-  head = object_cache_hmap_head(p->object);
+  shard = p->shard;
+  head = object_cache_hmap_head(shard, p->object);
 
   p->hmap_prev = NULL;
   p->hmap_next = *head;
   if (*head)
     (*head)->hmap_prev = p;
   *head = p;
+
+  if (++shard->hmap_count > shard->hmap_size)
+    object_cache_hmap_resize(shard, shard->hmap_size << 1);
 }
 
 void object_cache_hmap_unlink(struct object_cache *p) {
   struct object_cache **head;
 
-  head = object_cache_hmap_head(p->object);
+  head = object_cache_hmap_head(p->shard, p->object);
 
   if (p->hmap_prev)
     p->hmap_prev->hmap_next = p->hmap_next;
@@ -319,70 +754,134 @@ void object_cache_hmap_unlink(struct object_cache *p) {
     *head = p->hmap_next;
   if (p->hmap_next)
     p->hmap_next->hmap_prev = p->hmap_prev;
+  p->shard->hmap_count--;
 
   p->hmap_next = NULL;
   p->hmap_prev = NULL;
 }
 
+void object_cache_hmap_resize(struct object_cache_shard *shard,
+                              uint32_t size) {
+  struct object_cache **hmap, **head, *p, *next;
+  uint32_t i, old_size;
+
+  hmap = shard->hmap;
+  old_size = shard->hmap_size;
+
+  if (!(shard->hmap = calloc(size, sizeof(*shard->hmap))))
+    stderror("calloc");
+  shard->hmap_size = size;
+
+  for (i = 0; i < old_size; i++) {
+    for (p = hmap[i]; p; p = next) {
+      next = p->hmap_next;
+
+      head = object_cache_hmap_head(shard, p->object);
+      p->hmap_prev = NULL;
+      p->hmap_next = *head;
+      if (*head)
+        (*head)->hmap_prev = p;
+      *head = p;
+    }
+  }
+  free(hmap);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
-// Section:     Object cache LRU linking
+// Section:     Object cache queue linking
 
-void object_cache_lru_link(struct object_cache *p) {
-  p->lru_prev = NULL;
-  p->lru_next = object_cache_lru_head;
-  if (object_cache_lru_head)
-    object_cache_lru_head->lru_prev = p;
+void object_cache_queue_link(struct object_cache *p, uint32_t queue) {
+  struct object_cache_queue *q;
+
+  assert(queue < OBJECT_POLICY_QUEUES);
+  q = &p->shard->queue[queue];
+
+  p->queue = queue;
+  p->atime = __sync_add_and_fetch(&object_cache_tick, 1);
+  p->queue_prev = NULL;
+  p->queue_next = q->head;
+  if (q->head)
+    q->head->queue_prev = p;
   else
-    object_cache_lru_tail = p;
-  object_cache_lru_head = p;
+    q->tail = p;
+  q->head = p;
+  q->count++;
 }
 
-void object_cache_lru_pushfront(struct object_cache *p) {
-  sem_wait(&object_cache_global_lock);
+void object_cache_queue_pushfront(struct object_cache *p) {
+  if (p->shard->queue[p->queue].head != p) {
+    object_cache_queue_unlink(p);
+    object_cache_queue_link(p, p->queue);
+  }
+}
 
-  object_cache_lru_unlink(p);
-  object_cache_lru_link(p);
+void object_cache_queue_unlink(struct object_cache *p) {
+  struct object_cache_queue *q;
 
-  sem_post(&object_cache_global_lock);
-}
+  q = &p->shard->queue[p->queue];
 
-void object_cache_lru_unlink(struct object_cache *p) {
-  if (p->lru_prev)
-    p->lru_prev->lru_next = p->lru_next;
+  if (p->queue_prev)
+    p->queue_prev->queue_next = p->queue_next;
   else
-    object_cache_lru_head = p->lru_next;
-  if (p->lru_next)
-    p->lru_next->lru_prev = p->lru_prev;
+    q->head = p->queue_next;
+  if (p->queue_next)
+    p->queue_next->queue_prev = p->queue_prev;
   else
-    object_cache_lru_tail = p->lru_prev;
+    q->tail = p->queue_prev;
+  q->count--;
+
+  p->queue_next = NULL;
+  p->queue_prev = NULL;
+}
 
-  p->lru_next = NULL;
-  p->lru_prev = NULL;
+bool object_cache_queue_evictable(struct object_cache *p) {
+  // An object that is being uploaded is clean but still pinned by the
+  // flush thread, evicting it would not free anything.
+  return !(p->flag & (OBJECT_CACHE_DIRTY | OBJECT_CACHE_DESTROY |
+                      OBJECT_CACHE_FLUSHING));
+}
+
+struct object_cache *object_cache_queue_candidate(
+    struct object_cache_shard *shard, uint32_t queue) {
+  struct object_cache *p;
+
+  for (p = shard->queue[queue].tail; p; p = p->queue_prev) {
+    if (object_cache_queue_evictable(p))
+      return p;
+  }
+  return NULL;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache FSH linking
 
 void object_cache_fsh_link(struct object_cache *p) {
+  struct object_cache_shard *shard;
+
+  shard = p->shard;
+
   p->fsh_next = NULL;
-  if (!object_cache_fsh_head) {
-    object_cache_fsh_head = p;
-  } else {
-    p->fsh_prev = object_cache_fsh_tail;
-    object_cache_fsh_tail->fsh_next = p;
-  }
-  object_cache_fsh_tail = p;
+  p->fsh_prev = shard->fsh_tail;
+  if (!shard->fsh_head)
+    shard->fsh_head = p;
+  else
+    shard->fsh_tail->fsh_next = p;
+  shard->fsh_tail = p;
 }
 
 void object_cache_fsh_unlink(struct object_cache *p) {
+  struct object_cache_shard *shard;
+
+  shard = p->shard;
+
   if (p->fsh_prev)
     p->fsh_prev->fsh_next = p->fsh_next;
   else
-    object_cache_fsh_head = p->fsh_next;
+    shard->fsh_head = p->fsh_next;
   if (p->fsh_next)
     p->fsh_next->fsh_prev = p->fsh_prev;
   else
-    object_cache_fsh_tail = p->fsh_prev;
+    shard->fsh_tail = p->fsh_prev;
 
   p->fsh_next = NULL;
   p->fsh_prev = NULL;
@@ -393,46 +892,190 @@ void object_cache_fsh_unlink(struct object_cache *p) {
 
 struct object_cache *object_cache_lookup_and_acquire(
     struct volume_object object) {
+  struct object_cache_shard *shard;
   struct object_cache *p;
 
-  sem_wait(&object_cache_global_lock);
+  shard = object_cache_shard_get(object);
+  sem_wait(&shard->lock);
 
-  for (p = *object_cache_hmap_head(object); p; p = p->hmap_next) {
+  for (p = *object_cache_hmap_head(shard, object); p; p = p->hmap_next) {
     if (object_equals(p->object, object)) {
       object_cache_acquire(p);
       break;
     }
   }
 
-  sem_post(&object_cache_global_lock);
+  sem_post(&shard->lock);
   return p;
 }
 
 void object_cache_acquire(struct object_cache *p) {
-  p->refcount++;
+  __sync_add_and_fetch(&p->refcount, 1);
 }
 
 void object_cache_release(struct object_cache *p, int32_t flag) {
-  sem_wait(&object_cache_global_lock);
+  struct object_cache_shard *shard;
+  int32_t refcount;
+
+  // Dropping a reference that is not the last one can never destroy the
+  // object, so it does not need the shard lock.
+  if (!flag) {
+    while ((refcount = p->refcount) > 1) {
+      if (__sync_bool_compare_and_swap(&p->refcount, refcount, refcount - 1))
+        return;
+    }
+  }
+
+  shard = p->shard;
+  sem_wait(&shard->lock);
 
   if (p->refcount)
-    p->refcount--;
+    __sync_sub_and_fetch(&p->refcount, 1);
   if ((flag & OBJECT_RELEASE_DESTROY))
-    p->flag |= OBJECT_CACHE_DESTROY;
+    object_cache_flag_set(p, OBJECT_CACHE_DESTROY);
 
-  if (!p->refcount && (p->flag & OBJECT_CACHE_DESTROY) &&
-      ((flag & OBJECT_RELEASE_FORCE) || !(p->flag & OBJECT_CACHE_DIRTY)))
+  if (object_cache_destroyable(p, flag)) {
+    // Demoting copies the whole object, which is done without the shard
+    // lock. The extra reference keeps the object around and found by
+    // lookups until the copy is in the second tier.
+    if (object_cache_l2_eligible(p)) {
+      object_cache_acquire(p);
+      sem_post(&shard->lock);
+      object_cache_demote(p, flag);
+      return;
+    }
     object_cache_destroy(p);
+  }
 
-  sem_post(&object_cache_global_lock);
+  sem_post(&shard->lock);
+}
+
+bool object_cache_destroyable(struct object_cache *p, int32_t flag) {
+  return (!p->refcount && (p->flag & OBJECT_CACHE_DESTROY) &&
+          ((flag & OBJECT_RELEASE_FORCE) || !(p->flag & OBJECT_CACHE_DIRTY)));
+}
+
+void object_cache_demote(struct object_cache *p, int32_t flag) {
+  struct object_cache_shard *shard;
+  struct object_cache *l2;
+
+  object_cache_lock_shared(p);
+  l2 = object_cache_l2_copy(p);
+  object_cache_unlock(p);
+
+  // Whoever looked the object up in the mean time now owns destroying it,
+  // and a write or delete since the copy makes the copy worthless.
+  shard = p->shard;
+  sem_wait(&shard->lock);
+  __sync_sub_and_fetch(&p->refcount, 1);
+  if (!object_cache_destroyable(p, flag)) {
+    sem_post(&shard->lock);
+    if (l2)
+      object_cache_l2_discard(l2);
+    return;
+  }
+
+  if (l2 && object_cache_l2_eligible(p))
+    object_cache_l2_link(l2);
+  else if (l2)
+    object_cache_l2_discard(l2);
+  object_cache_destroy(p);
+  sem_post(&shard->lock);
+}
+
+void object_cache_flag_set(struct object_cache *p, int32_t flag) {
+  __sync_fetch_and_or(&p->flag, flag);
+}
+
+void object_cache_flag_clear(struct object_cache *p, int32_t flag) {
+  __sync_fetch_and_and(&p->flag, ~flag);
+}
+
+void object_cache_touch(struct object_cache *p) {
+  sem_wait(&p->shard->lock);
+  object_policy_intr_ptr->access(p);
+  sem_post(&p->shard->lock);
+}
+
+void object_cache_lock_init(struct object_cache *p) {
+  pthread_rwlockattr_t attr;
+
+  // Prefer writers, a steady stream of readers on a hot object must not
+  // starve out writes and fetches.
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  if (pthread_rwlock_init(&p->lock, &attr) != 0)
+    error("Error creating object lock");
+  pthread_rwlockattr_destroy(&attr);
 }
 
 void object_cache_lock(struct object_cache *p) {
-  sem_wait(&p->lock);
+  pthread_rwlock_wrlock(&p->lock);
+}
+
+void object_cache_lock_shared(struct object_cache *p) {
+  pthread_rwlock_rdlock(&p->lock);
 }
 
 void object_cache_unlock(struct object_cache *p) {
-  sem_post(&p->lock);
+  pthread_rwlock_unlock(&p->lock);
+}
+
+bool object_cache_trylock(struct object_cache *p) {
+  return pthread_rwlock_trywrlock(&p->lock) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object segment digests
+
+void object_cache_segment_invalidate(struct object_cache *p, uint32_t offt,
+                                     uint32_t len) {
+  uint32_t from, to;
+
+  // A write past the end also fills the gap before it with zeros.
+  from = min(offt, p->seg_end);
+  to = offt + len;
+  p->seg_end = max(p->seg_end, to);
+
+  for (from /= OBJECT_SEGMENT_SIZE; from * OBJECT_SEGMENT_SIZE < to; from++)
+    p->seg_valid &= ~(1ULL << from);
+}
+
+int object_cache_segment_digest(struct object_cache *p, char *digest) {
+  char *buf;
+  uint32_t i, len, rlen;
+  int ret;
+
+  buf = NULL;
+  for (i = 0; i < OBJECT_SEGMENTS; i++) {
+    if ((p->seg_valid & (1ULL << i)))
+      continue;
+
+    if (!buf && !(buf = malloc(OBJECT_SEGMENT_SIZE)))
+      stderror("malloc");
+
+    for (len = 0; len < OBJECT_SEGMENT_SIZE; len += rlen) {
+      rlen = OBJECT_SEGMENT_SIZE - len;
+      if ((ret = object_cache_intr_ptr->read(p, i * OBJECT_SEGMENT_SIZE + len,
+                                             buf + len, &rlen)) != SUCCESS) {
+        free(buf);
+        return ret;
+      }
+      if (!rlen)
+        break;
+    }
+
+    p->seg_digest[i] = digest_segment(buf, len);
+    p->seg_valid |= 1ULL << i;
+  }
+
+  if (buf)
+    free(buf);
+
+  // The object digest is taken over the list of segment digests.
+  digest_compute((const char*) p->seg_digest, sizeof(p->seg_digest), digest);
+  return SUCCESS;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -441,25 +1084,67 @@ void object_cache_unlock(struct object_cache *p) {
 void object_cache_mark_dirty(struct object_cache *p) {
   if ((p->flag & OBJECT_CACHE_DIRTY))
     return;
-  p->flag |= OBJECT_CACHE_DIRTY;
 
-  sem_wait(&object_cache_global_lock);
-  object_cache_fsh_link(p);
-  sem_post(&object_cache_global_lock);
+  sem_wait(&p->shard->lock);
+  if (!(p->flag & OBJECT_CACHE_DIRTY)) {
+    object_cache_flag_set(p, OBJECT_CACHE_DIRTY);
+    p->dtime = object_cache_now();
+    object_cache_fsh_link(p);
+    __sync_add_and_fetch(&object_cache_dirty_count, 1);
+  }
+  sem_post(&p->shard->lock);
+}
+
+void object_cache_mark_complete(struct object_cache *p) {
+  struct object_cache_shard *shard;
+  bool kick;
+
+  shard = p->shard;
+  kick = false;
+
+  // Moving the object to the head of the flush list and backdating it makes
+  // it the next pick regardless of the expire time.
+  sem_wait(&shard->lock);
+  if ((p->flag & (OBJECT_CACHE_DIRTY | OBJECT_CACHE_FLUSHING)) ==
+      OBJECT_CACHE_DIRTY && p->dtime) {
+    object_cache_fsh_unlink(p);
+    p->fsh_prev = NULL;
+    p->fsh_next = shard->fsh_head;
+    if (shard->fsh_head)
+      shard->fsh_head->fsh_prev = p;
+    else
+      shard->fsh_tail = p;
+    shard->fsh_head = p;
+    p->dtime = 0;
+    kick = true;
+  }
+  sem_post(&shard->lock);
+
+  if (!kick)
+    return;
+
+  // The wake is not paired with a wait on the flushed semaphore, the thread
+  // taking it is told not to post one back.
+  __sync_add_and_fetch(&object_cache_dirty_complete, 1);
+  __sync_add_and_fetch(&object_cache_thread_kicks, 1);
+  sem_post(&object_cache_thread_wake);
 }
 
 void object_cache_mark_clean(struct object_cache *p) {
   if (!(p->flag & OBJECT_CACHE_DIRTY))
     return;
-  p->flag &= ~OBJECT_CACHE_DIRTY;
 
-  sem_wait(&object_cache_global_lock);
-  object_cache_fsh_unlink(p);
-  sem_post(&object_cache_global_lock);
+  sem_wait(&p->shard->lock);
+  if ((p->flag & OBJECT_CACHE_DIRTY)) {
+    object_cache_flag_clear(p, OBJECT_CACHE_DIRTY);
+    object_cache_fsh_unlink(p);
+    __sync_sub_and_fetch(&object_cache_dirty_count, 1);
+  }
+  sem_post(&p->shard->lock);
 }
 
 void object_cache_mark_present(struct object_cache *p) {
-  p->flag &= ~OBJECT_CACHE_NOT_PRESENT;
+  object_cache_flag_clear(p, OBJECT_CACHE_NOT_PRESENT);
 }
 
 int object_cache_fulfill(struct object_cache *p) {
@@ -471,14 +1156,23 @@ int object_cache_fulfill(struct object_cache *p) {
   if (!(p->flag & OBJECT_CACHE_NOT_PRESENT))
     return SUCCESS;
 
+  // Nothing is fetched for an object that is written over completely, the
+  // store may or may not hold it, so its digest is left unknown.
   if (trxlog_match(&p->trxlog, 0, OBJECT_MAX_SIZE))
     goto out;
 
-  ret = volume_get_object(p->object, &rbuf, &rlen);
-  if (ret == NOT_FOUND)
-    goto out;
-  if (ret != SUCCESS)
-    return ret;
+  if (object_cache_l2_take(p->object, &rbuf, &rlen) != SUCCESS) {
+    ret = volume_get_object(p->object, &rbuf, &rlen);
+
+    // The store holds nothing for this object, which is what a flush of
+    // only zeros would leave behind, so such a flush needs no request.
+    if (ret == NOT_FOUND) {
+      memcpy(p->md5, object_cache_zero_md5, OBJECT_MD5_DIGEST_LENGTH);
+      goto out;
+    }
+    if (ret != SUCCESS)
+      return ret;
+  }
 
   sbuf = rbuf;
 
@@ -507,17 +1201,79 @@ int object_cache_fulfill(struct object_cache *p) {
 
   free(rbuf);
 
+  // Whatever the store held is new to the segment digests.
+  object_cache_flag_clear(p, OBJECT_CACHE_COMPACT);
+  object_cache_segment_invalidate(p, 0, to);
+
 out:
   object_cache_mark_present(p);
+  object_cache_persist(p);
   return SUCCESS;
 }
 
-int object_cache_flush(struct object_cache *p) {
+void object_cache_persist(struct object_cache *p) {
+  if (object_cache_intr_ptr->persist)
+    object_cache_intr_ptr->persist(p);
+}
+
+int object_cache_flush(struct object_cache *p, struct volume_buffer *vb) {
   char new_md5[OBJECT_MD5_DIGEST_LENGTH];
-  char *buf, *rbuf;
+  char *buf;
+  uint32_t len;
+  int ret;
+
+  // Only the copy is taken under the object lock, readers and writers are
+  // free to use the object while it is hashed and uploaded. The copy is the
+  // only one made before the data is handed to the store.
+  object_cache_lock(p);
+  ret = object_cache_snapshot(p, new_md5, volume_buffer_data(vb), &buf, &len);
+  object_cache_unlock(p);
+
+  if (ret != SUCCESS || !buf)
+    return ret;
+
+  // An object of only zeros is removed from the store instead of uploaded,
+  // reads of a missing object already come back as zeros.
+  if (misc_is_zero(buf + OBJECT_MD5_DIGEST_LENGTH, len)) {
+    memcpy(new_md5, object_cache_zero_md5, OBJECT_MD5_DIGEST_LENGTH);
+    if (memcmp(new_md5, p->md5, OBJECT_MD5_DIGEST_LENGTH) != 0) {
+      ret = volume_delete_object(p->object);
+      if (ret != SUCCESS && ret != NOT_FOUND) {
+        object_cache_mark_dirty(p);
+        return ret;
+      }
+      __sync_add_and_fetch(&object_cache_zero_elided, 1);
+    }
+    goto out;
+  }
+
+  memcpy(buf, new_md5, OBJECT_MD5_DIGEST_LENGTH);
+  if ((ret = volume_put_object_reserved(p->object,
+                                        OBJECT_MD5_DIGEST_LENGTH + len,
+                                        vb)) != SUCCESS) {
+    // The snapshot was never stored, so the object has to be written again
+    // even if nobody touched it in the mean time.
+    object_cache_mark_dirty(p);
+    return ret;
+  }
+
+out:
+  object_cache_lock(p);
+  memcpy(p->md5, new_md5, OBJECT_MD5_DIGEST_LENGTH);
+  object_cache_persist(p);
+  object_cache_unlock(p);
+  return SUCCESS;
+}
+
+int object_cache_snapshot(struct object_cache *p, char *digest, char *buf,
+                          char **dst, uint32_t *dst_len) {
+  char *rbuf;
   uint32_t len, rlen;
   int ret;
 
+  *dst = NULL;
+  *dst_len = 0;
+
   if (!(p->flag & OBJECT_CACHE_DIRTY))
     return SUCCESS;
 
@@ -527,83 +1283,136 @@ int object_cache_flush(struct object_cache *p) {
       return ret;
   }
 
-  if (!(buf = malloc(OBJECT_MD5_DIGEST_LENGTH + OBJECT_MAX_SIZE)))
-    stderror("malloc");
+  // Only the segments written since the last flush are hashed, and an
+  // object that ends up with its stored digest is not copied at all.
+  if ((ret = object_cache_segment_digest(p, digest)) != SUCCESS)
+    return ret;
+  if (memcmp(digest, p->md5, OBJECT_MD5_DIGEST_LENGTH) == 0) {
+    object_cache_mark_clean(p);
+    return SUCCESS;
+  }
 
   rbuf = buf + OBJECT_MD5_DIGEST_LENGTH;
   len = 0;
   while (len < OBJECT_MAX_SIZE) {
     rlen = OBJECT_MAX_SIZE - len;
     if ((ret = object_cache_intr_ptr->read(p, len, rbuf + len,
-                                           &rlen)) != SUCCESS) {
-      free(buf);
+                                           &rlen)) != SUCCESS)
       return ret;
-    }
     if (!rlen)
       break;
     len += rlen;
   }
 
-  MD5((uint8_t*) rbuf, len, (uint8_t*) new_md5);
-  if (memcmp(new_md5, p->md5, OBJECT_MD5_DIGEST_LENGTH) != 0) {
-    memcpy(p->md5, new_md5, OBJECT_MD5_DIGEST_LENGTH);
-    memcpy(buf,    new_md5, OBJECT_MD5_DIGEST_LENGTH);
-
-    if ((ret = volume_put_object(p->object, buf,
-                                 OBJECT_MD5_DIGEST_LENGTH + len)) != SUCCESS) {
-      free(buf);
-      return ret;
-    }
-  }
-  free(buf);
-
+  // Writes that land after this point mark the object dirty again and it
+  // is picked up by a later flush.
   object_cache_mark_clean(p);
+
+  *dst = buf;
+  *dst_len = len;
   return SUCCESS;
 }
 
-void object_cache_garbage_collect(uint32_t needed) {
-  struct object_cache *p;
+bool object_cache_over(uint32_t percent) {
+  uint64_t used;
 
-  assert(needed <= object_cache_max);
+  used = object_cache_intr_ptr->get_capacity() +
+         object_cache_reserved * OBJECT_MAX_SIZE;
+  return (used * 100 > object_cache_max * percent ||
+          object_cache_count * 100 > object_cache_max_count * percent);
+}
 
-  while (object_cache_intr_ptr->get_capacity() + needed > object_cache_max ||
-         object_cache_count > OBJECT_MAX_CACHE_COUNT) {
-    sem_wait(&object_cache_global_lock);
+void object_cache_reserve() {
+  __sync_add_and_fetch(&object_cache_reserved, 1);
 
-    for (p = object_cache_lru_tail; p; p = p->lru_prev) {
-      if (!(p->flag & OBJECT_CACHE_DIRTY) &&
-          !(p->flag & OBJECT_CACHE_DESTROY)) {
-        object_cache_acquire(p);
-        break;
+  if (object_cache_over(OBJECT_RECLAIM_HIGH))
+    sem_post(&object_cache_reclaim_wake);
+
+  // The reclaim thread normally keeps enough headroom, callers only block
+  // once the hard limit itself is exceeded.
+  while (object_cache_over(100) && object_cache_reclaim_wait());
+}
+
+void object_cache_unreserve(struct object_cache *p) {
+  if ((p->flag & OBJECT_CACHE_RESERVED) &&
+      (__sync_fetch_and_and(&p->flag, ~OBJECT_CACHE_RESERVED) &
+       OBJECT_CACHE_RESERVED))
+    __sync_sub_and_fetch(&object_cache_reserved, 1);
+}
+
+void object_cache_garbage_collect(uint32_t percent) {
+  struct object_cache_shard *shard, *best;
+  struct object_cache *p;
+  uint64_t priority, best_priority;
+  uint32_t i;
+
+  while (object_cache_over(percent)) {
+    // Each shard runs the policy on its own objects, so compare the victim
+    // of every shard by policy priority to approximate a global policy.
+    best = NULL;
+    best_priority = 0;
+    for (i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+      shard = &object_cache_shard_list[i];
+
+      sem_wait(&shard->lock);
+      if ((p = object_cache_evict_candidate(shard, &priority)) &&
+          (!best || priority < best_priority)) {
+        best = shard;
+        best_priority = priority;
       }
+      sem_post(&shard->lock);
     }
 
-    sem_post(&object_cache_global_lock);
+    p = NULL;
+    if (best) {
+      sem_wait(&best->lock);
+      if ((p = object_cache_evict_candidate(best, &priority)))
+        object_cache_acquire(p);
+      sem_post(&best->lock);
+    }
+
+    // A victim that can still shrink gets compacted first, it is evicted
+    // once it comes up again with the cache still over the limit.
+    if (p && object_cache_intr_ptr->compact &&
+        !(p->flag & OBJECT_CACHE_COMPACT) && object_cache_compact(p)) {
+      object_cache_release(p, 0);
+      continue;
+    }
 
     if (p) {
       object_cache_release(p, OBJECT_RELEASE_DESTROY);
+      object_cache_reclaim_notify();
       continue;
     }
+    if (best)
+      continue;
 
     sem_post(&object_cache_thread_wake);
     sem_wait(&object_cache_thread_flushed);
   }
 }
 
+struct object_cache *object_cache_evict_candidate(
+    struct object_cache_shard *shard, uint64_t *priority) {
+  return object_policy_intr_ptr->candidate(shard, priority);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache destruction
 
 void object_cache_destroy(struct object_cache *p) {
-  sem_wait(&object_cache_count_lock);
-  object_cache_count--;
-  sem_post(&object_cache_count_lock);
+  __sync_sub_and_fetch(&object_cache_count, 1);
+  object_cache_unreserve(p);
 
-  object_cache_lru_unlink(p);
+  object_policy_intr_ptr->unlink(p);
   object_cache_hmap_unlink(p);
-  if ((p->flag & OBJECT_CACHE_DIRTY))
+  if ((p->flag & OBJECT_CACHE_DIRTY)) {
     object_cache_fsh_unlink(p);
+    __sync_sub_and_fetch(&object_cache_dirty_count, 1);
+  }
 
   trxlog_free(&p->trxlog);
+  pthread_rwlock_destroy(&p->lock);
   object_cache_intr_ptr->destroy(p);
 }
 
@@ -611,22 +1420,34 @@ void object_cache_destroy(struct object_cache *p) {
 // Section:     Object cache thread
 
 void object_cache_thread(void *__unused) {
+  struct volume_buffer vb;
   struct timespec tm;
   uint32_t interval;
-  bool want_post, queue_empty;
+  bool want_post, queue_empty, urgent, kicked;
+
+  volume_buffer_init(&vb, OBJECT_MD5_DIGEST_LENGTH + OBJECT_MAX_SIZE);
 
   interval = 0;
   queue_empty = false;
   while (object_cache_thread_running || !queue_empty) {
     clock_gettime(CLOCK_REALTIME, &tm);
     tm.tv_sec += interval;
+    kicked = false;
     if (sem_timedwait(&object_cache_thread_wake, &tm) < 0)
       want_post = false;
-    else
+    else if (object_cache_thread_kick_take()) {
+      want_post = false;
+      kicked = true;
+    } else
       want_post = true;
 
-    if (!object_cache_thread_fulfill(&queue_empty) &&
-        object_cache_thread_running)
+    // Below the background limit only expired objects are written, above it
+    // or when somebody waits on a flush everything goes.
+    urgent = (want_post || !object_cache_thread_running ||
+              object_cache_dirty_count > object_cache_dirty_background);
+
+    if (!object_cache_thread_fulfill(&queue_empty, urgent, &vb) &&
+        object_cache_thread_running && !kicked)
       interval = OBJECT_THREAD_INTERVAL;
     else
       interval = 0;
@@ -634,30 +1455,49 @@ void object_cache_thread(void *__unused) {
     if (want_post)
       sem_post(&object_cache_thread_flushed);
   }
+
+  volume_buffer_free(&vb);
+}
+
+bool object_cache_thread_kick_take() {
+  uint32_t kicks;
+
+  while ((kicks = object_cache_thread_kicks)) {
+    if (__sync_bool_compare_and_swap(&object_cache_thread_kicks, kicks,
+                                     kicks - 1))
+      return true;
+  }
+  return false;
 }
 
-bool object_cache_thread_fulfill(bool *queue_empty) {
+bool object_cache_thread_fulfill(bool *queue_empty, bool urgent,
+                                 struct volume_buffer *vb) {
+  struct object_cache_shard *shard;
   struct object_cache *p;
+  uint32_t i, start;
   int ret;
+  bool pressure;
 
-  sem_wait(&object_cache_global_lock);
+  pressure = object_cache_over(OBJECT_RECLAIM_HIGH);
 
-  if ((p = object_cache_fsh_head))
-    object_cache_acquire(p);
-  if (!p || !p->fsh_next)
-    *queue_empty = true;
-  else
-    *queue_empty = false;
+  p = NULL;
+  start = __sync_fetch_and_add(&object_cache_fsh_start, 1);
+  for (i = 0; i < OBJECT_CACHE_SHARDS && !p; i++) {
+    shard = &object_cache_shard_list[(start + i) % OBJECT_CACHE_SHARDS];
 
-  sem_post(&object_cache_global_lock);
+    sem_wait(&shard->lock);
+    p = object_cache_thread_pick(shard, urgent, pressure);
+    sem_post(&shard->lock);
+  }
+
+  *queue_empty = !p;
 
   if (!p)
     return false;
 
-  object_cache_lock(p);
-  ret = object_cache_flush(p);
-  object_cache_unlock(p);
+  ret = object_cache_flush(p, vb);
 
+  object_cache_flag_clear(p, OBJECT_CACHE_FLUSHING);
   object_cache_release(p, 0);
 
   if (ret != SUCCESS) {
@@ -666,3 +1506,363 @@ bool object_cache_thread_fulfill(bool *queue_empty) {
   }
   return true;
 }
+
+struct object_cache *object_cache_thread_pick(
+    struct object_cache_shard *shard, bool urgent, bool pressure) {
+  struct object_cache *p;
+  uint64_t now;
+
+  // Dirty objects the policy is about to evict go first when the cache is
+  // full, the reclaimer can only free them once they are clean.
+  if (pressure && (p = object_cache_dirty_candidate(shard)))
+    goto claim;
+
+  // Objects already claimed by another flush thread are skipped, the claim
+  // is dropped once that thread is done with the object. The list is in the
+  // order objects became dirty, so after the first one that has not expired
+  // none of the rest have either.
+  now = object_cache_now();
+  for (p = shard->fsh_head; p; p = p->fsh_next) {
+    if ((p->flag & OBJECT_CACHE_FLUSHING))
+      continue;
+    if (!urgent && now - p->dtime < object_cache_dirty_expire)
+      return NULL;
+    goto claim;
+  }
+  return NULL;
+
+claim:
+  object_cache_flag_set(p, OBJECT_CACHE_FLUSHING);
+  object_cache_acquire(p);
+  return p;
+}
+
+struct object_cache *object_cache_dirty_candidate(
+    struct object_cache_shard *shard) {
+  struct object_cache *p;
+  uint32_t queue, i;
+
+  for (queue = 0; queue < OBJECT_POLICY_QUEUES; queue++) {
+    for (p = shard->queue[queue].tail, i = 0;
+         p && i < OBJECT_DIRTY_SCAN;
+         p = p->queue_prev, i++) {
+      if ((p->flag & (OBJECT_CACHE_DIRTY | OBJECT_CACHE_FLUSHING)) ==
+          OBJECT_CACHE_DIRTY)
+        return p;
+    }
+  }
+  return NULL;
+}
+
+void object_cache_dirty_throttle() {
+  if (object_cache_dirty_count <= object_cache_dirty_limit)
+    return;
+
+  // Writers wait for the flush threads the same way the reclaimer does,
+  // one object at a time until the dirty data is back under the limit.
+  __sync_add_and_fetch(&object_cache_dirty_throttled, 1);
+  while (object_cache_dirty_count > object_cache_dirty_limit &&
+         object_cache_thread_running) {
+    sem_post(&object_cache_thread_wake);
+    sem_wait(&object_cache_thread_flushed);
+  }
+}
+
+uint64_t object_cache_now() {
+  struct timespec tm;
+
+  clock_gettime(CLOCK_MONOTONIC, &tm);
+  return tm.tv_sec;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Reclaim thread
+
+void object_cache_reclaim_thread(void *__unused) {
+  struct timespec tm;
+
+  while (object_cache_reclaim_running) {
+    clock_gettime(CLOCK_REALTIME, &tm);
+    tm.tv_sec += OBJECT_RECLAIM_INTERVAL;
+    sem_timedwait(&object_cache_reclaim_wake, &tm);
+
+    // Objects grow after they are created, so the timed wake up catches a
+    // cache that crossed the high watermark through writes alone.
+    if (object_cache_intr_ptr->compact)
+      object_cache_compact_cold(object_cache_over(OBJECT_RECLAIM_HIGH));
+
+    if (object_cache_intr_ptr->sync)
+      object_cache_persist_dirty();
+
+    if (object_cache_over(OBJECT_RECLAIM_HIGH) || object_cache_reclaim_waiters)
+      object_cache_garbage_collect(OBJECT_RECLAIM_LOW);
+
+    object_cache_reclaim_notify();
+  }
+  object_cache_reclaim_notify();
+}
+
+void object_cache_compact_cold(bool pressure) {
+  struct object_cache_shard *shard;
+  struct object_cache *p, *list[OBJECT_COMPACT_BATCH];
+  uint32_t i, j, queue, count;
+
+  // A medium that keeps hot data in a faster form shrinks the objects the
+  // policy has not seen in a while, or under pressure the least recently
+  // used ones, dirty or not. Objects in use are skipped rather than waited
+  // for, they are not cold.
+  for (i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+    shard = &object_cache_shard_list[i];
+
+    count = 0;
+    sem_wait(&shard->lock);
+    for (queue = 0; queue < OBJECT_POLICY_QUEUES; queue++) {
+      for (p = shard->queue[queue].tail;
+           p && count < OBJECT_COMPACT_BATCH &&
+           (pressure || object_cache_cold(p));
+           p = p->queue_prev) {
+        if (!(p->flag & (OBJECT_CACHE_COMPACT | OBJECT_CACHE_DESTROY))) {
+          object_cache_acquire(p);
+          list[count++] = p;
+        }
+      }
+    }
+    sem_post(&shard->lock);
+
+    for (j = 0; j < count; j++) {
+      object_cache_compact(list[j]);
+      object_cache_release(list[j], 0);
+    }
+  }
+}
+
+void object_cache_persist_dirty() {
+  struct object_cache_shard *shard;
+  struct object_cache *p, *list[OBJECT_PERSIST_BATCH];
+  uint32_t i, j, count, done;
+
+  // Dirty objects written since their last record are persisted in batches,
+  // and the medium syncs once for all of them. Objects in use are left for
+  // the next pass, a batch that made no progress ends the shard.
+  for (i = 0; i < OBJECT_CACHE_SHARDS; i++) {
+    shard = &object_cache_shard_list[i];
+
+    do {
+      count = 0;
+      sem_wait(&shard->lock);
+      for (p = shard->fsh_head; p && count < OBJECT_PERSIST_BATCH;
+           p = p->fsh_next) {
+        if ((p->flag & (OBJECT_CACHE_PERSIST | OBJECT_CACHE_DESTROY)) ==
+            OBJECT_CACHE_PERSIST) {
+          object_cache_acquire(p);
+          list[count++] = p;
+        }
+      }
+      sem_post(&shard->lock);
+
+      for (done = 0, j = 0; j < count; j++) {
+        if (object_cache_trylock(list[j])) {
+          object_cache_flag_clear(list[j], OBJECT_CACHE_PERSIST);
+          object_cache_persist(list[j]);
+          object_cache_unlock(list[j]);
+          done++;
+        }
+        object_cache_release(list[j], 0);
+      }
+    } while (count == OBJECT_PERSIST_BATCH && done);
+  }
+
+  object_cache_intr_ptr->sync();
+}
+
+bool object_cache_compact(struct object_cache *p) {
+  bool ret;
+
+  if (!object_cache_trylock(p))
+    return false;
+  if ((ret = object_cache_intr_ptr->compact(p) == SUCCESS))
+    object_cache_flag_set(p, OBJECT_CACHE_COMPACT);
+  object_cache_unlock(p);
+  return ret;
+}
+
+bool object_cache_cold(struct object_cache *p) {
+  // Cold means every cached object could have been used since this one.
+  return object_cache_tick - p->atime > object_cache_count;
+}
+
+bool object_cache_reclaim_wait() {
+  // The reclaimer itself demotes objects, it can not wait for its own pass.
+  if (!object_cache_reclaim_running ||
+      pthread_equal(pthread_self(), object_cache_reclaim_id))
+    return false;
+
+  __sync_add_and_fetch(&object_cache_reclaim_waiters, 1);
+  sem_post(&object_cache_reclaim_wake);
+  sem_wait(&object_cache_reclaim_done);
+  return true;
+}
+
+void object_cache_reclaim_notify() {
+  uint32_t waiters;
+
+  waiters = __sync_lock_test_and_set(&object_cache_reclaim_waiters, 0);
+  while (waiters--)
+    sem_post(&object_cache_reclaim_done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Second cache tier
+
+bool object_cache_l2_eligible(struct object_cache *p) {
+  return (object_cache_l2_intr_ptr &&
+          !(p->flag & (OBJECT_CACHE_NOT_PRESENT | OBJECT_CACHE_DIRTY |
+                       OBJECT_CACHE_DELETED)));
+}
+
+struct object_cache *object_cache_l2_copy(struct object_cache *p) {
+  struct object_cache *l2, *victim;
+  char *buf;
+  uint32_t offt, len;
+
+  // Room is made before the copy, a medium with a fixed number of slots
+  // must never run out. When every slot is held by a copy in flight the
+  // object is simply not demoted.
+  sem_wait(&object_cache_l2.lock);
+  while (object_cache_l2_live >= object_cache_l2_max_count &&
+         (victim = object_cache_l2.queue[0].tail))
+    object_cache_l2_evict(victim);
+  if (object_cache_l2_live >= object_cache_l2_max_count) {
+    sem_post(&object_cache_l2.lock);
+    return NULL;
+  }
+  object_cache_l2_live++;
+  sem_post(&object_cache_l2.lock);
+
+  if (!(l2 = object_cache_l2_intr_ptr->create()))
+    error("Cache creation failure");
+
+  l2->object = p->object;
+  l2->shard = &object_cache_l2;
+  memcpy(l2->md5, p->md5, OBJECT_MD5_DIGEST_LENGTH);
+
+  if (!(buf = malloc(OBJECT_CACHE_L2_COPY_SIZE)))
+    stderror("malloc");
+
+  for (offt = 0; offt < OBJECT_MAX_SIZE; offt += len) {
+    len = OBJECT_CACHE_L2_COPY_SIZE;
+    if (object_cache_intr_ptr->read(p, offt, buf, &len) != SUCCESS ||
+        object_cache_l2_intr_ptr->write(l2, offt, buf, len) != SUCCESS) {
+      free(buf);
+      object_cache_l2_discard(l2);
+      return NULL;
+    }
+    if (len < OBJECT_CACHE_L2_COPY_SIZE)
+      break;
+  }
+  free(buf);
+
+  // Demoted objects are cold by definition.
+  if (object_cache_l2_intr_ptr->compact)
+    object_cache_l2_intr_ptr->compact(l2);
+  return l2;
+}
+
+void object_cache_l2_link(struct object_cache *l2) {
+  struct object_cache *victim;
+
+  sem_wait(&object_cache_l2.lock);
+
+  // A copy left from before the object was last fetched is older than this
+  // one, the object was in the first tier until now.
+  for (victim = *object_cache_hmap_head(&object_cache_l2, l2->object); victim;
+       victim = victim->hmap_next) {
+    if (object_equals(victim->object, l2->object)) {
+      object_cache_l2_evict(victim);
+      break;
+    }
+  }
+
+  // The second tier only holds clean copies, so making room is just a
+  // matter of dropping its least recently demoted objects.
+  while (object_cache_l2_intr_ptr->get_capacity() > object_cache_l2_max &&
+         (victim = object_cache_l2.queue[0].tail))
+    object_cache_l2_evict(victim);
+
+  object_cache_queue_link(l2, 0);
+  object_cache_hmap_link(l2);
+  object_cache_l2_demotions++;
+
+  sem_post(&object_cache_l2.lock);
+}
+
+void object_cache_l2_discard(struct object_cache *l2) {
+  object_cache_l2_intr_ptr->destroy(l2);
+
+  sem_wait(&object_cache_l2.lock);
+  object_cache_l2_live--;
+  sem_post(&object_cache_l2.lock);
+}
+
+void object_cache_l2_evict(struct object_cache *victim) {
+  object_cache_queue_unlink(victim);
+  object_cache_hmap_unlink(victim);
+  object_cache_l2_intr_ptr->destroy(victim);
+  object_cache_l2_live--;
+}
+
+int object_cache_l2_take(struct volume_object object, char **buf,
+                         uint32_t *len) {
+  struct object_cache *l2;
+  char *rbuf;
+  uint32_t rlen;
+  int ret;
+
+  if (!object_cache_l2_intr_ptr)
+    return NOT_FOUND;
+
+  // The copy moves back to the first tier, so it leaves the second one.
+  sem_wait(&object_cache_l2.lock);
+  for (l2 = *object_cache_hmap_head(&object_cache_l2, object); l2;
+       l2 = l2->hmap_next) {
+    if (l2->object.index == object.index && l2->object.chunk == object.chunk) {
+      object_cache_queue_unlink(l2);
+      object_cache_hmap_unlink(l2);
+      break;
+    }
+  }
+  if (l2)
+    object_cache_l2_hits++;
+  else
+    object_cache_l2_misses++;
+  sem_post(&object_cache_l2.lock);
+
+  if (!l2)
+    return NOT_FOUND;
+
+  if (!(rbuf = malloc(OBJECT_MD5_DIGEST_LENGTH + OBJECT_MAX_SIZE)))
+    stderror("malloc");
+  memcpy(rbuf, l2->md5, OBJECT_MD5_DIGEST_LENGTH);
+
+  rlen = OBJECT_MAX_SIZE;
+  ret = object_cache_l2_intr_ptr->read(l2, 0, rbuf + OBJECT_MD5_DIGEST_LENGTH,
+                                       &rlen);
+  object_cache_l2_discard(l2);
+
+  if (ret != SUCCESS) {
+    free(rbuf);
+    return ret;
+  }
+
+  *buf = rbuf;
+  *len = OBJECT_MD5_DIGEST_LENGTH + rlen;
+  return SUCCESS;
+}
+
+void object_cache_l2_drop(struct volume_object object) {
+  char *buf;
+  uint32_t len;
+
+  if (object_cache_l2_take(object, &buf, &len) == SUCCESS)
+    free(buf);
+}
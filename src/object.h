@@ -11,6 +11,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <semaphore.h>
 #include "store.h"
 #include "volume.h"
@@ -22,16 +23,41 @@
 #define OBJECT_MAX_SIZE           (4 * 1024 * 1024)
 #define OBJECT_MAX_SIZE_LOG2      22
 
-#define OBJECT_MAX_HMAP           (1 << 8)
+#define OBJECT_MIN_HMAP           (1 << 8)
 
-#define OBJECT_MAX_CACHE_COUNT    128
+#define OBJECT_CACHE_SHARDS       (1 << 4)
+
+#define OBJECT_POLICY_QUEUES      2
+
+#define OBJECT_MIN_CACHE_COUNT    128
+#define OBJECT_CACHE_ENTRY_SIZE   (256 * 1024)
 
 #define OBJECT_THREAD_STACK_SIZE  (1 * 1024 * 1024)
 
-#define OBJECT_THREAD_INTERVAL    15
+#define OBJECT_THREAD_INTERVAL    1
+
+#define OBJECT_DIRTY_EXPIRE       15
+#define OBJECT_DIRTY_BACKGROUND   20
+#define OBJECT_DIRTY_RATIO        50
+#define OBJECT_DIRTY_SCAN         16
+
+#define OBJECT_RECLAIM_INTERVAL   1
+#define OBJECT_RECLAIM_LOW        80
+#define OBJECT_RECLAIM_HIGH       90
+
+#define OBJECT_COMPACT_BATCH      64
+#define OBJECT_PERSIST_BATCH      64
+
+#define OBJECT_FLUSH_THREADS      4
+#define OBJECT_MAX_FLUSH_THREADS  64
 
 #define OBJECT_MD5_DIGEST_LENGTH  16
 
+#define OBJECT_SEGMENT_SIZE       (64 * 1024)
+#define OBJECT_SEGMENTS           (OBJECT_MAX_SIZE / OBJECT_SEGMENT_SIZE)
+
+#define OBJECT_CACHE_L2_COPY_SIZE (256 * 1024)
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache interface table definition
 
@@ -39,6 +65,11 @@ enum object_flag {
   OBJECT_CACHE_NOT_PRESENT = 1 << 0,
   OBJECT_CACHE_DIRTY       = 1 << 1,
   OBJECT_CACHE_DESTROY     = 1 << 2,
+  OBJECT_CACHE_FLUSHING    = 1 << 3,
+  OBJECT_CACHE_RESERVED    = 1 << 4,
+  OBJECT_CACHE_DELETED     = 1 << 5,
+  OBJECT_CACHE_COMPACT     = 1 << 6,
+  OBJECT_CACHE_PERSIST     = 1 << 7,
 };
 
 enum object_release_flag {
@@ -46,28 +77,55 @@ enum object_release_flag {
   OBJECT_RELEASE_FORCE     = 1 << 1,
 };
 
+struct object_cache_shard;
+
 struct object_cache {
   struct object_cache *hmap_prev, *hmap_next,
-          *lru_prev, *lru_next,
+          *queue_prev, *queue_next,
           *fsh_prev, *fsh_next;
+  struct object_cache_shard *shard;
   struct trxlog trxlog;
   struct volume_object object;
-  sem_t lock;
+  pthread_rwlock_t lock;
   int32_t refcount, flag;
+  uint32_t queue;
+  uint64_t atime, dtime;
   char md5[OBJECT_MD5_DIGEST_LENGTH];
+
+  uint64_t seg_digest[OBJECT_SEGMENTS], seg_valid;
+  uint32_t seg_end;
+};
+
+struct object_cache_queue {
+  struct object_cache *head, *tail;
+  uint32_t count;
+};
+
+struct object_cache_shard {
+  struct object_cache_queue queue[OBJECT_POLICY_QUEUES];
+  struct object_cache *fsh_head, *fsh_tail,
+                      **hmap;
+  uint32_t id, hmap_size, hmap_count;
+  sem_t lock;
 };
 
 struct object_cache_intr {
-  void (*load)   ();
+  void (*load)   (uint64_t, uint64_t);
   void (*unload) ();
 
-  uint64_t (*get_max)      ();
-  uint64_t (*get_capacity) ();
+  uint64_t (*get_max)       ();
+  uint64_t (*get_max_count) ();
+  uint64_t (*get_capacity)  ();
 
   struct object_cache *(*create) ();
   int (*read)    (struct object_cache*, uint32_t, char *, uint32_t *);
   int (*write)   (struct object_cache*, uint32_t, const char *, uint32_t);
   int (*destroy) (struct object_cache*);
+  int (*compact) (struct object_cache*);
+
+  void (*persist) (struct object_cache*);
+  void (*sync)    ();
+  void (*restore) ();
 };
 
 struct object_cache_intr_opt {
@@ -75,13 +133,36 @@ struct object_cache_intr_opt {
   const struct object_cache_intr *intr;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object replacement policy table definition
+
+struct object_policy_intr {
+  void (*load)   (uint64_t max_count);
+  void (*unload) ();
+
+  void (*link)   (struct object_cache*);
+  void (*access) (struct object_cache*);
+  void (*unlink) (struct object_cache*);
+  struct object_cache *(*candidate) (struct object_cache_shard*, uint64_t *);
+};
+
+struct object_policy_intr_opt {
+  const char *name;
+  const struct object_policy_intr *intr;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object initialization
 
 void object_load();
+void object_load_l2();
 void object_load_thread();
+void object_load_dirty();
+void object_load_reclaim();
 void object_unload();
+void object_unload_l2();
 void object_unload_thread();
+void object_unload_reclaim();
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object interface functions
@@ -92,26 +173,60 @@ int object_write(struct volume_object object, uint32_t offt, const char *buf,
                  uint32_t len);
 int object_exists(struct volume_object object);
 int object_delete(struct volume_object object);
+int object_delete_list(const struct volume_object *object, uint32_t count);
+int object_prefetch(struct volume_object object);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache limits
+
+uint64_t object_get_cache_max();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache policy
+
+void object_load_policy();
+void object_unload_policy();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache medium selection
+
+const struct object_cache_intr *object_cache_intr_get(const char *name);
+void object_cache_limits(const struct object_cache_intr *intr,
+                         const char *cmax, uint64_t *max,
+                         uint64_t *max_count);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache creation
 
 struct object_cache *object_cache_create_and_aquire(
     struct volume_object object);
+void object_cache_restore(struct object_cache *p);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object cache sharding
+
+uint64_t object_cache_hash(struct volume_object object);
+struct object_cache_shard *object_cache_shard_get(struct volume_object object);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache hashmap linking
 
-struct object_cache **object_cache_hmap_head(struct volume_object object);
+struct object_cache **object_cache_hmap_head(struct object_cache_shard *shard,
+                                             struct volume_object object);
 void object_cache_hmap_link(struct object_cache *p);
 void object_cache_hmap_unlink(struct object_cache *p);
+void object_cache_hmap_resize(struct object_cache_shard *shard,
+                              uint32_t size);
 
 ////////////////////////////////////////////////////////////////////////////////
-// Section:     Object cache LRU linking
+// Section:     Object cache queue linking
 
-void object_cache_lru_link(struct object_cache *p);
-void object_cache_lru_pushfront(struct object_cache *p);
-void object_cache_lru_unlink(struct object_cache *p);
+void object_cache_queue_link(struct object_cache *p, uint32_t queue);
+void object_cache_queue_pushfront(struct object_cache *p);
+void object_cache_queue_unlink(struct object_cache *p);
+bool object_cache_queue_evictable(struct object_cache *p);
+struct object_cache *object_cache_queue_candidate(
+    struct object_cache_shard *shard, uint32_t queue);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache FSH linking
@@ -125,19 +240,43 @@ void object_cache_fsh_unlink(struct object_cache *p);
 struct object_cache *object_cache_lookup_and_acquire(
     struct volume_object object);
 void object_cache_acquire(struct object_cache *p);
+void object_cache_lock_init(struct object_cache *p);
 void object_cache_lock(struct object_cache *p);
+void object_cache_lock_shared(struct object_cache *p);
 void object_cache_unlock(struct object_cache *p);
+bool object_cache_trylock(struct object_cache *p);
 void object_cache_release(struct object_cache *p, int32_t flag);
+bool object_cache_destroyable(struct object_cache *p, int32_t flag);
+void object_cache_demote(struct object_cache *p, int32_t flag);
+void object_cache_flag_set(struct object_cache *p, int32_t flag);
+void object_cache_flag_clear(struct object_cache *p, int32_t flag);
+void object_cache_touch(struct object_cache *p);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Object segment digests
+
+void object_cache_segment_invalidate(struct object_cache *p, uint32_t offt,
+                                     uint32_t len);
+int object_cache_segment_digest(struct object_cache *p, char *digest);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache fulfilling and flushing
 
 void object_cache_mark_dirty(struct object_cache *p);
+void object_cache_mark_complete(struct object_cache *p);
 void object_cache_mark_clean(struct object_cache *p);
 void object_cache_mark_present(struct object_cache *p);
 int object_cache_fulfill(struct object_cache *p);
-int object_cache_flush(struct object_cache *p);
-void object_cache_garbage_collect(uint32_t needed);
+void object_cache_persist(struct object_cache *p);
+int object_cache_flush(struct object_cache *p, struct volume_buffer *vb);
+int object_cache_snapshot(struct object_cache *p, char *digest, char *buf,
+                          char **dst, uint32_t *dst_len);
+bool object_cache_over(uint32_t percent);
+void object_cache_reserve();
+void object_cache_unreserve(struct object_cache *p);
+void object_cache_garbage_collect(uint32_t percent);
+struct object_cache *object_cache_evict_candidate(
+    struct object_cache_shard *shard, uint64_t *priority);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object cache destruction
@@ -148,4 +287,35 @@ void object_cache_destroy(struct object_cache *p);
 // Section:     Object cache thread
 
 void object_cache_thread(void *__unused);
-bool object_cache_thread_fulfill(bool *queue_empty);
+bool object_cache_thread_kick_take();
+bool object_cache_thread_fulfill(bool *queue_empty, bool urgent,
+                                 struct volume_buffer *vb);
+struct object_cache *object_cache_thread_pick(
+    struct object_cache_shard *shard, bool urgent, bool pressure);
+struct object_cache *object_cache_dirty_candidate(
+    struct object_cache_shard *shard);
+void object_cache_dirty_throttle();
+uint64_t object_cache_now();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Reclaim thread
+
+void object_cache_reclaim_thread(void *__unused);
+void object_cache_reclaim_notify();
+void object_cache_compact_cold(bool pressure);
+void object_cache_persist_dirty();
+bool object_cache_compact(struct object_cache *p);
+bool object_cache_cold(struct object_cache *p);
+bool object_cache_reclaim_wait();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Second cache tier
+
+bool object_cache_l2_eligible(struct object_cache *p);
+struct object_cache *object_cache_l2_copy(struct object_cache *p);
+void object_cache_l2_link(struct object_cache *l2);
+void object_cache_l2_discard(struct object_cache *l2);
+void object_cache_l2_evict(struct object_cache *victim);
+int object_cache_l2_take(struct volume_object object, char **buf,
+                         uint32_t *len);
+void object_cache_l2_drop(struct volume_object object);
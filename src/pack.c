@@ -25,7 +25,7 @@ bool pack_compress(const char *in_buf, uint32_t in_len, char **out_buf,
   char *sbuf, *rbuf;
   uLongf rlen;
 
-  if (!(sbuf = malloc(sizeof(*hdr) + in_len)))
+  if (!(sbuf = malloc(pack_bound(in_len))))
     stderror("malloc");
 
   hdr = (struct pack_header*) sbuf;
@@ -35,16 +35,51 @@ bool pack_compress(const char *in_buf, uint32_t in_len, char **out_buf,
 
   rbuf = sbuf + sizeof(*hdr);
   rlen = in_len;
-  if (compress((Bytef*) rbuf, &rlen, (const Bytef*) in_buf, in_len) == Z_OK)
+  if (compress((Bytef*) rbuf, &rlen, (const Bytef*) in_buf, in_len) == Z_OK) {
     hdr->flag |= PACK_FLAG_COMPRESSED;
-  else
+  } else {
     memcpy(rbuf, in_buf, in_len);
+    rlen = in_len;
+  }
 
   *out_buf = sbuf;
   *out_len = sizeof(*hdr) + rlen;
   return true;
 }
 
+bool pack_compress_reserved(char *in_buf, uint32_t in_len, char *out_buf,
+                            char **res_buf, uint32_t *res_len) {
+  struct pack_header *hdr;
+  uLongf rlen;
+
+  hdr = (struct pack_header*) out_buf;
+  rlen = in_len;
+  if (compress((Bytef*) out_buf + sizeof(*hdr), &rlen,
+               (const Bytef*) in_buf, in_len) == Z_OK) {
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->flag = PACK_FLAG_COMPRESSED;
+    hdr->orig_len = in_len;
+
+    *res_buf = out_buf;
+    *res_len = sizeof(*hdr) + rlen;
+    return true;
+  }
+
+  // Data that does not shrink is sent from where it is, the header goes
+  // into the headroom the caller left in front of it.
+  hdr = (struct pack_header*) (in_buf - PACK_HEADROOM);
+  memset(hdr, 0, sizeof(*hdr));
+  hdr->orig_len = in_len;
+
+  *res_buf = (char*) hdr;
+  *res_len = sizeof(*hdr) + in_len;
+  return true;
+}
+
+uint32_t pack_bound(uint32_t len) {
+  return sizeof(struct pack_header) + len;
+}
+
 bool pack_uncompress(const char *in_buf, uint32_t in_len, char **out_buf,
                      uint32_t *out_len) {
   struct pack_header *hdr;
@@ -24,10 +24,18 @@ struct pack_header {
   uint32_t orig_len;
 } __attribute__((aligned(8)));
 
+#define PACK_HEADROOM  sizeof(struct pack_header)
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Compression / Uncompression
 
 bool pack_compress(const char *in_buf, uint32_t in_len, char **out_buf,
                    uint32_t *out_len);
+// The input must be preceded by PACK_HEADROOM bytes owned by the caller,
+// data that does not compress gets its header written there. Only use it on
+// buffers laid out for it, see volume_buffer.
+bool pack_compress_reserved(char *in_buf, uint32_t in_len, char *out_buf,
+                            char **res_buf, uint32_t *res_len);
+uint32_t pack_bound(uint32_t len);
 bool pack_uncompress(const char *in_buf, uint32_t in_len, char **out_buf,
                      uint32_t *out_len);
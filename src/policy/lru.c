@@ -0,0 +1,50 @@
+/*
+ * cloudfs: lru source
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "log.h"
+#include "object.h"
+#include "policy/lru.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class:       lru
+// Description: Least recently used replacement policy
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Replacement policy table
+
+const struct object_policy_intr lru_intr = {
+  .link      = lru_link,
+  .access    = lru_access,
+  .unlink    = lru_unlink,
+  .candidate = lru_candidate,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Policy operations
+
+void lru_link(struct object_cache *p) {
+  object_cache_queue_link(p, LRU_QUEUE);
+}
+
+void lru_access(struct object_cache *p) {
+  object_cache_queue_pushfront(p);
+}
+
+void lru_unlink(struct object_cache *p) {
+  object_cache_queue_unlink(p);
+}
+
+struct object_cache *lru_candidate(struct object_cache_shard *shard,
+                                   uint64_t *priority) {
+  struct object_cache *p;
+
+  if ((p = object_cache_queue_candidate(shard, LRU_QUEUE)))
+    *priority = p->atime;
+  return p;
+}
@@ -0,0 +1,31 @@
+/*
+ * cloudfs: lru header
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include "object.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define LRU_QUEUE  0
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Replacement policy table
+
+extern const struct object_policy_intr lru_intr;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Policy operations
+
+void lru_link(struct object_cache *p);
+void lru_access(struct object_cache *p);
+void lru_unlink(struct object_cache *p);
+struct object_cache *lru_candidate(struct object_cache_shard *shard,
+                                   uint64_t *priority);
@@ -0,0 +1,192 @@
+/*
+ * cloudfs: twoq source
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log.h"
+#include "misc.h"
+#include "object.h"
+#include "policy/twoq.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class:       twoq
+// Description: 2Q replacement policy. New objects enter a FIFO and are only
+//              promoted to the main LRU when they are referenced again after
+//              falling out of it, so a single streaming scan cannot push the
+//              frequently used objects out of the cache.
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Replacement policy table
+
+const struct object_policy_intr twoq_intr = {
+  .load      = twoq_load,
+  .unload    = twoq_unload,
+
+  .link      = twoq_link,
+  .access    = twoq_access,
+  .unlink    = twoq_unlink,
+  .candidate = twoq_candidate,
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Ghost lists, protected by the shard lock
+
+static struct twoq_ghost twoq_ghost_list[OBJECT_CACHE_SHARDS];
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Initialization
+
+void twoq_load(uint64_t max_count) {
+  uint64_t size;
+  uint32_t i;
+
+  // The ghost list needs to span about half of what the shard holds, a
+  // shorter history forgets objects before they come back.
+  size = max_count / OBJECT_CACHE_SHARDS / TWOQ_GHOST_RATIO;
+  size = max(size, TWOQ_GHOST_MIN);
+  for (i = 0; i < OBJECT_CACHE_SHARDS; i++)
+    twoq_ghost_init(&twoq_ghost_list[i], size);
+}
+
+void twoq_unload() {
+  uint32_t i;
+
+  for (i = 0; i < OBJECT_CACHE_SHARDS; i++)
+    twoq_ghost_free(&twoq_ghost_list[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Policy operations
+
+void twoq_link(struct object_cache *p) {
+  if (twoq_ghost_take(&twoq_ghost_list[p->shard->id],
+                      object_cache_hash(p->object)))
+    object_cache_queue_link(p, TWOQ_QUEUE_MAIN);
+  else
+    object_cache_queue_link(p, TWOQ_QUEUE_IN);
+}
+
+void twoq_access(struct object_cache *p) {
+  // Hits on the FIFO are deliberately ignored, the repeated accesses of a
+  // sequential read all land while the object is still new.
+  if (p->queue == TWOQ_QUEUE_MAIN)
+    object_cache_queue_pushfront(p);
+}
+
+void twoq_unlink(struct object_cache *p) {
+  if (p->queue == TWOQ_QUEUE_IN)
+    twoq_ghost_push(&twoq_ghost_list[p->shard->id],
+                    object_cache_hash(p->object));
+  object_cache_queue_unlink(p);
+}
+
+struct object_cache *twoq_candidate(struct object_cache_shard *shard,
+                                    uint64_t *priority) {
+  struct object_cache *p;
+  uint32_t in, total;
+
+  in = shard->queue[TWOQ_QUEUE_IN].count;
+  total = in + shard->queue[TWOQ_QUEUE_MAIN].count;
+
+  // The FIFO is drained first once it holds more than its share, the
+  // priority puts such victims ahead of every main queue victim.
+  if (in * TWOQ_IN_RATIO > total || !shard->queue[TWOQ_QUEUE_MAIN].count) {
+    if ((p = object_cache_queue_candidate(shard, TWOQ_QUEUE_IN))) {
+      *priority = p->atime;
+      return p;
+    }
+  }
+
+  if ((p = object_cache_queue_candidate(shard, TWOQ_QUEUE_MAIN))) {
+    *priority = p->atime | TWOQ_PRIORITY_MAIN;
+    return p;
+  }
+
+  if ((p = object_cache_queue_candidate(shard, TWOQ_QUEUE_IN)))
+    *priority = p->atime;
+  return p;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Ghost list operations
+
+void twoq_ghost_init(struct twoq_ghost *ghost, uint32_t size) {
+  uint32_t buckets;
+
+  for (buckets = 1; buckets < size; buckets <<= 1);
+
+  memset(ghost, 0, sizeof(*ghost));
+  if (!(ghost->hash = calloc(size, sizeof(*ghost->hash))) ||
+      !(ghost->chain = calloc(size, sizeof(*ghost->chain))) ||
+      !(ghost->head = calloc(buckets, sizeof(*ghost->head))))
+    stderror("calloc");
+  ghost->size = size;
+  ghost->mask = buckets - 1;
+}
+
+void twoq_ghost_free(struct twoq_ghost *ghost) {
+  if (ghost->hash)
+    free(ghost->hash);
+  if (ghost->chain)
+    free(ghost->chain);
+  if (ghost->head)
+    free(ghost->head);
+  memset(ghost, 0, sizeof(*ghost));
+}
+
+void twoq_ghost_push(struct twoq_ghost *ghost, uint64_t hash) {
+  uint32_t pos, bucket;
+
+  if (!ghost->size)
+    return;
+
+  // The oldest entry makes room, its slot may already be empty if it was
+  // taken back.
+  pos = ghost->next;
+  if (ghost->hash[pos])
+    twoq_ghost_remove(ghost, pos);
+
+  ghost->hash[pos] = hash | 1;
+  bucket = twoq_ghost_bucket(ghost, hash);
+  ghost->chain[pos] = ghost->head[bucket];
+  ghost->head[bucket] = pos + 1;
+  ghost->next = (pos + 1) % ghost->size;
+}
+
+bool twoq_ghost_take(struct twoq_ghost *ghost, uint64_t hash) {
+  uint32_t link;
+
+  if (!ghost->size)
+    return false;
+  for (link = ghost->head[twoq_ghost_bucket(ghost, hash)]; link;
+       link = ghost->chain[link - 1]) {
+    if (ghost->hash[link - 1] == (hash | 1)) {
+      twoq_ghost_remove(ghost, link - 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+void twoq_ghost_remove(struct twoq_ghost *ghost, uint32_t pos) {
+  uint32_t *link;
+
+  link = &ghost->head[twoq_ghost_bucket(ghost, ghost->hash[pos])];
+  while (*link != pos + 1)
+    link = &ghost->chain[*link - 1];
+  *link = ghost->chain[pos];
+
+  ghost->hash[pos] = 0;
+  ghost->chain[pos] = 0;
+}
+
+uint32_t twoq_ghost_bucket(struct twoq_ghost *ghost, uint64_t hash) {
+  // The low bits picked the shard, they are the same for every entry here.
+  return (hash / OBJECT_CACHE_SHARDS) & ghost->mask;
+}
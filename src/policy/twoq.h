@@ -0,0 +1,67 @@
+/*
+ * cloudfs: twoq header
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include "object.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define TWOQ_QUEUE_IN      0
+#define TWOQ_QUEUE_MAIN    1
+
+#define TWOQ_IN_RATIO      4
+
+#define TWOQ_GHOST_MIN     64
+#define TWOQ_GHOST_RATIO   2
+
+#define TWOQ_PRIORITY_MAIN (1ULL << 63)
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Replacement policy table
+
+extern const struct object_policy_intr twoq_intr;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Ghost list of evicted objects
+
+// The ring remembers the most recent evictions from the FIFO, the chained
+// index over it keeps lookups cheap at the sizes 2Q needs. Links hold a
+// ring position plus one, a hash of zero marks an empty or taken slot.
+struct twoq_ghost {
+  uint64_t *hash;
+  uint32_t *head, *chain;
+  uint32_t size, mask, next;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Initialization
+
+void twoq_load(uint64_t max_count);
+void twoq_unload();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Policy operations
+
+void twoq_link(struct object_cache *p);
+void twoq_access(struct object_cache *p);
+void twoq_unlink(struct object_cache *p);
+struct object_cache *twoq_candidate(struct object_cache_shard *shard,
+                                    uint64_t *priority);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Ghost list operations
+
+void twoq_ghost_init(struct twoq_ghost *ghost, uint32_t size);
+void twoq_ghost_free(struct twoq_ghost *ghost);
+void twoq_ghost_push(struct twoq_ghost *ghost, uint64_t hash);
+bool twoq_ghost_take(struct twoq_ghost *ghost, uint64_t hash);
+void twoq_ghost_remove(struct twoq_ghost *ghost, uint32_t pos);
+uint32_t twoq_ghost_bucket(struct twoq_ghost *ghost, uint64_t hash);
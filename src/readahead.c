@@ -0,0 +1,217 @@
+/*
+ * cloudfs: readahead source
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <inttypes.h>
+#include "config.h"
+#include "log.h"
+#include "misc.h"
+#include "object.h"
+#include "readahead.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Class:       readahead
+// Description: Sequential stream detection and chunk prefetching
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Prefetch queue
+
+static struct volume_object readahead_queue[READAHEAD_MAX_QUEUE];
+
+static uint32_t readahead_queue_head = 0,
+                readahead_queue_size = 0;
+
+static sem_t readahead_queue_lock,
+             readahead_queue_wake;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Readahead threads
+
+static pthread_t *readahead_thread_id = NULL;
+
+static uint32_t readahead_thread_count = 0,
+                readahead_window_max = 0;
+
+static bool readahead_running = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Readahead construction / destruction
+
+void readahead_load() {
+  pthread_attr_t pattr;
+  const char *window, *threads;
+  uint64_t cache_window;
+  uint32_t i;
+
+  readahead_window_max = READAHEAD_DEFAULT_WINDOW;
+  if ((window = config_get("readahead"))) {
+    readahead_window_max = strtoul(window, NULL, 10);
+    if (readahead_window_max > READAHEAD_MAX_WINDOW)
+      error("Readahead must be at most %d chunks", READAHEAD_MAX_WINDOW);
+  }
+
+  // Never prefetch more than a quarter of the cache, otherwise the stream
+  // would evict its own prefetched chunks before they are read.
+  cache_window = (object_get_cache_max() / 4) >> OBJECT_MAX_SIZE_LOG2;
+  readahead_window_max = min(readahead_window_max, cache_window);
+  if (!readahead_window_max)
+    return;
+
+  readahead_thread_count = READAHEAD_DEFAULT_THREADS;
+  if ((threads = config_get("readahead-threads"))) {
+    readahead_thread_count = strtoul(threads, NULL, 10);
+    if (readahead_thread_count < 1 ||
+        readahead_thread_count > READAHEAD_MAX_THREADS)
+      error("Readahead threads must be between 1 and %d",
+            READAHEAD_MAX_THREADS);
+  }
+
+  if (!(readahead_thread_id = calloc(readahead_thread_count,
+                                     sizeof(*readahead_thread_id))))
+    stderror("calloc");
+
+  sem_init(&readahead_queue_lock, 0, 1);
+  sem_init(&readahead_queue_wake, 0, 0);
+  readahead_queue_head = 0;
+  readahead_queue_size = 0;
+
+  readahead_running = true;
+
+  pthread_attr_init(&pattr);
+  pthread_attr_setstacksize(&pattr, READAHEAD_THREAD_STACK_SIZE);
+  for (i = 0; i < readahead_thread_count; i++) {
+    if (pthread_create(&readahead_thread_id[i], &pattr,
+                       (void *(*)(void*)) readahead_thread, NULL) != 0)
+      error("Error creating readahead thread");
+  }
+  pthread_attr_destroy(&pattr);
+}
+
+void readahead_unload() {
+  uint32_t i;
+
+  if (!readahead_running)
+    return;
+
+  readahead_running = false;
+  for (i = 0; i < readahead_thread_count; i++)
+    sem_post(&readahead_queue_wake);
+  for (i = 0; i < readahead_thread_count; i++)
+    pthread_join(readahead_thread_id[i], NULL);
+
+  free(readahead_thread_id);
+  readahead_thread_id = NULL;
+  readahead_thread_count = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Stream detection
+
+void readahead_access(struct readahead_stream *s, struct volume_object object,
+                      uint64_t max_chunk) {
+  struct volume_object next;
+  uint64_t last;
+
+  if (!readahead_running)
+    return;
+
+  if (!s->active || s->index != object.index) {
+    s->active = true;
+    s->index = object.index;
+    s->last_chunk = object.chunk;
+    s->next_chunk = object.chunk + 1;
+    s->window = 0;
+    return;
+  }
+
+  if (object.chunk == s->last_chunk)
+    return;
+
+  // A jump anywhere but the following chunk ends the stream, the window
+  // starts growing again from one once sequential access resumes.
+  if (object.chunk != s->last_chunk + 1) {
+    s->last_chunk = object.chunk;
+    s->next_chunk = object.chunk + 1;
+    s->window = 0;
+    return;
+  }
+
+  s->window = (s->window ? min(s->window * 2, readahead_window_max) : 1);
+  s->last_chunk = object.chunk;
+  if (s->next_chunk <= object.chunk)
+    s->next_chunk = object.chunk + 1;
+
+  last = min(object.chunk + s->window, max_chunk);
+
+  next.index = object.index;
+  for (; s->next_chunk <= last; s->next_chunk++) {
+    next.chunk = s->next_chunk;
+    if (!readahead_queue_push(next))
+      break;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Prefetch queue
+
+bool readahead_queue_push(struct volume_object object) {
+  bool ret;
+
+  sem_wait(&readahead_queue_lock);
+  if (readahead_queue_size < READAHEAD_MAX_QUEUE) {
+    readahead_queue[(readahead_queue_head + readahead_queue_size) %
+                    READAHEAD_MAX_QUEUE] = object;
+    readahead_queue_size++;
+    ret = true;
+  } else {
+    ret = false;
+  }
+  sem_post(&readahead_queue_lock);
+
+  if (ret)
+    sem_post(&readahead_queue_wake);
+  return ret;
+}
+
+bool readahead_queue_pop(struct volume_object *object) {
+  bool ret;
+
+  sem_wait(&readahead_queue_lock);
+  if (readahead_queue_size) {
+    *object = readahead_queue[readahead_queue_head];
+    readahead_queue_head = (readahead_queue_head + 1) % READAHEAD_MAX_QUEUE;
+    readahead_queue_size--;
+    ret = true;
+  } else {
+    ret = false;
+  }
+  sem_post(&readahead_queue_lock);
+  return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Readahead thread
+
+void readahead_thread(void *__unused) {
+  struct volume_object object;
+  int ret;
+
+  while (1) {
+    sem_wait(&readahead_queue_wake);
+    if (!readahead_running)
+      break;
+    if (!readahead_queue_pop(&object))
+      continue;
+
+    if ((ret = object_prefetch(object)) != SUCCESS && ret != NOT_FOUND)
+      warning("Readahead error on %016" PRIx64 ":%016" PRIx64 ": %d",
+              object.index, object.chunk, ret);
+  }
+}
@@ -0,0 +1,58 @@
+/*
+ * cloudfs: readahead header
+ *   By Benjamin Kittridge. Copyright (C) 2013, All rights reserved.
+ *
+ */
+
+#pragma once
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Required includes
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "volume.h"
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define READAHEAD_THREAD_STACK_SIZE  (1 * 1024 * 1024)
+
+#define READAHEAD_DEFAULT_WINDOW     8
+#define READAHEAD_MAX_WINDOW         256
+#define READAHEAD_DEFAULT_THREADS    4
+#define READAHEAD_MAX_THREADS        64
+
+#define READAHEAD_MAX_QUEUE          (1 << 10)
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Stream state
+
+struct readahead_stream {
+  uint64_t index, last_chunk, next_chunk;
+  uint32_t window;
+  bool active;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Readahead initialization
+
+void readahead_load();
+void readahead_unload();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Stream detection
+
+void readahead_access(struct readahead_stream *s, struct volume_object object,
+                      uint64_t max_chunk);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Prefetch queue
+
+bool readahead_queue_push(struct volume_object object);
+bool readahead_queue_pop(struct volume_object *object);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Readahead thread
+
+void readahead_thread(void *__unused);
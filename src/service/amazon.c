@@ -37,16 +37,23 @@
 
 const struct store_intr amazon_intr = {
   .load           = amazon_load,
+  .unload         = amazon_unload,
 
   .create_bucket  = amazon_create_bucket,
   .exists_bucket  = amazon_exists_bucket,
   .delete_bucket  = amazon_delete_bucket,
 
   .list_object    = amazon_list_object,
+  .list_page      = amazon_list_page,
   .put_object     = amazon_put_object,
   .get_object     = amazon_get_object,
   .exists_object  = amazon_exists_object,
   .delete_object  = amazon_delete_object,
+  .delete_objects = amazon_delete_objects,
+
+#if CURL_ASYNC
+  .submit         = amazon_submit,
+#endif
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -74,6 +81,10 @@ void amazon_load() {
   curl_load();
 }
 
+void amazon_unload() {
+  curl_unload();
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Helper functions
 
@@ -162,6 +173,45 @@ static char *xml_decode(const char *str, uint32_t len) {
   return nstr;
 }
 
+static void astrcat(char **str, const char *format, ...) {
+  va_list args;
+  char *buf, *ptr;
+  uint32_t len;
+
+  va_start(args, format);
+  if (vasprintf(&buf, format, args) < 0)
+    stderror("vasprintf");
+  va_end(args);
+
+  len = (*str ? strlen(*str) : 0);
+  if (!(ptr = realloc(*str, len + strlen(buf) + 1)))
+    stderror("realloc");
+  ptr[len] = 0;
+  strcat(ptr, buf);
+  free(buf);
+
+  *str = ptr;
+}
+
+static char *xml_encode(const char *str) {
+  const char *ptr;
+  char *nstr;
+
+  nstr = NULL;
+  astrcat(&nstr, "");
+  for (ptr = str; *ptr; ptr++) {
+    switch (*ptr) {
+      case '<':  astrcat(&nstr, "&lt;");   break;
+      case '>':  astrcat(&nstr, "&gt;");   break;
+      case '&':  astrcat(&nstr, "&amp;");  break;
+      case '\'': astrcat(&nstr, "&apos;"); break;
+      case '"':  astrcat(&nstr, "&quot;"); break;
+      default:   astrcat(&nstr, "%c", *ptr); break;
+    }
+  }
+  return nstr;
+}
+
 static void xml_push_tags(struct store_list *list, const char *tag,
                           char *sbuf) {
   char *ptr, *name, *xml_name;
@@ -246,6 +296,56 @@ int amazon_list_object(const char *bucket, const char *prefix,
   return ret;
 }
 
+int amazon_list_page(const char *bucket, const char *prefix,
+                     const char *after, char **token,
+                     uint32_t max_count, struct store_list *list) {
+  char *buf, *url, *esc_prefix, *esc_marker;
+  const char *marker;
+  uint32_t len, size;
+  bool truncated;
+  int ret;
+
+  marker = (*token ? *token : after ? after : "");
+  esc_prefix = url_encode(prefix, strlen(prefix));
+  esc_marker = url_encode(marker, strlen(marker));
+  if (asprintf(&url, "/?prefix=%s&marker=%s&max-keys=%u",
+               esc_prefix, esc_marker, max_count) < 0)
+    stderror("asprintf");
+
+  buf = NULL;
+  ret = amazon_request_call(AMAZON_REQUEST_GET,
+                            bucket, url,
+                            NULL, 0,
+                            &buf, &len);
+
+  free(esc_prefix);
+  free(esc_marker);
+  free(url);
+
+  if (*token) {
+    free(*token);
+    *token = NULL;
+  }
+  if (ret != SUCCESS)
+    return ret;
+
+  if (!(buf = realloc(buf, len + 1)))
+    stderror("realloc");
+  buf[len] = 0;
+
+  // Without a delimiter S3 sends no NextMarker, a truncated listing goes on
+  // from the last key of the page.
+  truncated = strstr(buf, "<IsTruncated>true</IsTruncated>") != NULL;
+  size = list->size;
+  xml_push_tags(list, "<Key>", buf);
+  if (truncated && list->size > size &&
+      !(*token = strdup(list->item[list->size - 1])))
+    stderror("strdup");
+
+  free(buf);
+  return SUCCESS;
+}
+
 int amazon_put_object(const char *bucket, const char *object,
                       const char *buf, uint32_t len) {
   return amazon_request_call(AMAZON_REQUEST_PUT,
@@ -276,6 +376,55 @@ int amazon_delete_object(const char *bucket, const char *object) {
                              NULL, NULL);
 }
 
+int amazon_delete_objects(const char *bucket, const char **object,
+                          uint32_t count) {
+  uint32_t i;
+  int ret;
+
+  for (i = 0; i < count; i += AMAZON_DELETE_BATCH) {
+    if ((ret = amazon_delete_batch(bucket, object + i,
+                                   min(count - i, AMAZON_DELETE_BATCH))) !=
+        SUCCESS)
+      return ret;
+  }
+  return SUCCESS;
+}
+
+int amazon_delete_batch(const char *bucket, const char **object,
+                        uint32_t count) {
+  char *xml, *key, *buf;
+  uint32_t i, len;
+  int ret;
+
+  // Quiet mode only lists the keys that failed, keys that did not exist
+  // count as deleted.
+  xml = NULL;
+  astrcat(&xml, "<Delete><Quiet>true</Quiet>");
+  for (i = 0; i < count; i++) {
+    key = xml_encode(object[i]);
+    astrcat(&xml, "<Object><Key>%s</Key></Object>", key);
+    free(key);
+  }
+  astrcat(&xml, "</Delete>");
+
+  buf = NULL;
+  len = 0;
+  ret = amazon_request_call(AMAZON_REQUEST_POST,
+                            bucket, "/?delete",
+                            xml, strlen(xml),
+                            &buf, &len);
+
+  if (ret == SUCCESS && buf && memmem(buf, len, "<Error>", 7)) {
+    warning("Amazon S3 failed to delete some objects");
+    ret = SYS_ERROR;
+  }
+
+  free(xml);
+  if (buf)
+    free(buf);
+  return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Amazon request
 
@@ -292,35 +441,98 @@ int amazon_request_call(enum amazon_request_method method,
     c = amazon_request_new(method, bucket, object);
     amazon_request_set_req(c, data, data_len);
     amazon_request_perform(c);
-    if (!c->resp_code || c->resp_code == 500) {
+    if (amazon_request_retry(c)) {
       amazon_request_free(c);
       if (retry >= 2)
         warning("Failure while contacting Amazon S3, retrying...");
       sleep(retry * 5);
       continue;
     }
-    switch (c->resp_code) {
-      case 200:
-      case 204:
-        ret = SUCCESS;
-        if (out_buf) {
-          *out_buf = c->resp_data;
-          c->resp_data = NULL;
-        }
-        if (out_len)
-          *out_len = c->resp_len;
-        break;
-
-      case 404:
-        ret = NOT_FOUND;
-        break;
-    }
+    ret = amazon_request_result(c, out_buf, out_len);
     amazon_request_free(c);
     break;
   }
   return ret;
 }
 
+bool amazon_request_retry(struct amazon_request *c) {
+  return !c->resp_code || c->resp_code == 500;
+}
+
+int amazon_request_result(struct amazon_request *c, char **out_buf,
+                          uint32_t *out_len) {
+  switch (c->resp_code) {
+    case 200:
+    case 204:
+      if (out_buf) {
+        *out_buf = c->resp_data;
+        c->resp_data = NULL;
+      }
+      if (out_len)
+        *out_len = c->resp_len;
+      return SUCCESS;
+
+    case 404:
+      return NOT_FOUND;
+  }
+  return SYS_ERROR;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous requests
+
+#if CURL_ASYNC
+int amazon_submit(struct store_async *req) {
+  struct amazon_async *a;
+  enum amazon_request_method method;
+
+  switch (req->op) {
+    case STORE_ASYNC_PUT:     method = AMAZON_REQUEST_PUT;    break;
+    case STORE_ASYNC_GET:     method = AMAZON_REQUEST_GET;    break;
+    case STORE_ASYNC_EXISTS:  method = AMAZON_REQUEST_HEAD;   break;
+    case STORE_ASYNC_DELETE:  method = AMAZON_REQUEST_DELETE; break;
+    default:
+      return USER_ERROR;
+  }
+
+  if (!(a = calloc(sizeof(*a), 1)))
+    stderror("calloc");
+  a->req = req;
+  a->c = amazon_request_new(method, req->bucket, req->object);
+  if (method == AMAZON_REQUEST_PUT)
+    amazon_request_set_req(a->c, req->data, req->len);
+
+  a->async.curl = amazon_request_prepare(a->c);
+  a->async.done = amazon_async_done;
+  curl_async_submit(&a->async);
+  return SUCCESS;
+}
+
+void amazon_async_done(struct curl_async *async, CURLcode ret) {
+  struct amazon_async *a;
+  struct store_async *req;
+
+  a = (struct amazon_async*) async;
+  req = a->req;
+
+  if (ret != CURLE_OK)
+    warning("Curl failed: %s", curl_easy_strerror(ret));
+  amazon_request_finish(a->c, async->curl, ret);
+
+  // Retries back off with a sleep, which the multi thread must not do, so
+  // they go through the blocking path instead.
+  if (amazon_request_retry(a->c)) {
+    store_async_defer(req);
+  } else {
+    req->ret = amazon_request_result(a->c, &req->buf, &req->len);
+    req->complete(req);
+  }
+
+  amazon_request_free(a->c);
+  free(a);
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Request initialization
 
@@ -361,30 +573,11 @@ static const char *method(struct amazon_request *c) {
     case AMAZON_REQUEST_PUT:    return "PUT";
     case AMAZON_REQUEST_DELETE: return "DELETE";
     case AMAZON_REQUEST_HEAD:   return "HEAD";
+    case AMAZON_REQUEST_POST:   return "POST";
   }
   error("Invalid method passed");
 }
 
-static void astrcat(char **str, const char *format, ...) {
-  va_list args;
-  char *buf, *ptr;
-  uint32_t len;
-
-  va_start(args, format);
-  if (vasprintf(&buf, format, args) < 0)
-    stderror("vasprintf");
-  va_end(args);
-
-  len = (*str ? strlen(*str) : 0);
-  if (!(ptr = realloc(*str, len + strlen(buf) + 1)))
-    stderror("realloc");
-  ptr[len] = 0;
-  strcat(ptr, buf);
-  free(buf);
-
-  *str = ptr;
-}
-
 static void curdate(char *str, int32_t size) {
   static const char *lookup_week[7]   = { "Sun", "Mon", "Tue", "Wed",
                                           "Thu", "Fri", "Sat" },
@@ -408,17 +601,25 @@ static void curdate(char *str, int32_t size) {
 void amazon_request_perform(struct amazon_request *c) {
   CURL *curl;
   CURLcode ret;
+
+  curl = amazon_request_prepare(c);
+
+  if ((ret = curl_pool_perform(curl)) != CURLE_OK)
+    warning("Curl failed: %s", curl_easy_strerror(ret));
+
+  amazon_request_finish(c, curl, ret);
+}
+
+CURL *amazon_request_prepare(struct amazon_request *c) {
+  CURL *curl;
   struct curl_slist *header;
   char dig[MD5_DIGEST_LENGTH], date[1 << 9], *md5, *host, *auth;
 
-  if (!(curl = curl_easy_init()))
-    error("Unable to init curl");
+  curl = curl_pool_take();
 
   if (amazon_use_https) {
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
   }
-  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-  curl_easy_setopt(curl, CURLOPT_SHARE, curl_share_get());
   curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method(c));
   if (c->method == AMAZON_REQUEST_HEAD)
     curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
@@ -468,13 +669,18 @@ void amazon_request_perform(struct amazon_request *c) {
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, amazon_request_write_callback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, c);
 
-  if ((ret = curl_easy_perform(curl)) != CURLE_OK)
-    warning("Curl failed: %s", curl_easy_strerror(ret));
-  else
+  c->header = header;
+  return curl;
+}
+
+void amazon_request_finish(struct amazon_request *c, CURL *curl,
+                           CURLcode ret) {
+  if (ret == CURLE_OK)
     curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &c->resp_code);
 
-  curl_slist_free_all(header);
-  curl_easy_cleanup(curl);
+  curl_pool_give(curl);
+  curl_slist_free_all(c->header);
+  c->header = NULL;
 }
 
 char *amazon_request_access(struct amazon_request *c, const char *date,
@@ -492,7 +698,9 @@ char *amazon_request_access(struct amazon_request *c, const char *date,
     stderror("strdup");
   for (ptr = goodurl; *ptr && *ptr != '?'; ptr++)
     continue;
-  if (*ptr)
+  // Sub-resources are part of the signed resource, plain query parameters
+  // are not.
+  if (*ptr && strcmp(ptr, "?delete") != 0)
     *ptr++ = 0;
 
   astrcat(&data, "%s%s%s",
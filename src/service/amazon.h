@@ -12,11 +12,13 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "store.h"
+#include "service/curl_util.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Macros
 
 #define AMAZON_REQUEST_RETRY  12
+#define AMAZON_DELETE_BATCH   1000
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Request methods
@@ -25,7 +27,8 @@ enum amazon_request_method {
   AMAZON_REQUEST_GET,
   AMAZON_REQUEST_PUT,
   AMAZON_REQUEST_DELETE,
-  AMAZON_REQUEST_HEAD
+  AMAZON_REQUEST_HEAD,
+  AMAZON_REQUEST_POST
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -42,7 +45,19 @@ struct amazon_request {
   char *resp_data;
   uint32_t resp_len;
   long resp_code;
+
+  struct curl_slist *header;
+};
+
+#if CURL_ASYNC
+// The curl transfer comes first so the done callback can cast back to the
+// request it belongs to.
+struct amazon_async {
+  struct curl_async async;
+  struct amazon_request *c;
+  struct store_async *req;
 };
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Service table
@@ -58,6 +73,7 @@ extern const char *amazon_key, *amazon_secret, *amazon_location;
 // Section:     Load
 
 void amazon_load();
+void amazon_unload();
 void amazon_load_curl();
 void amazon_load_openssl();
 
@@ -73,12 +89,19 @@ int amazon_delete_bucket(const char *bucket);
 
 int amazon_list_object(const char *bucket, const char *prefix,
                        uint32_t max_count, struct store_list *list);
+int amazon_list_page(const char *bucket, const char *prefix,
+                     const char *after, char **token,
+                     uint32_t max_count, struct store_list *list);
 int amazon_put_object(const char *bucket, const char *object,
                       const char *buf, uint32_t len);
 int amazon_get_object(const char *bucket, const char *object,
                       char **buf, uint32_t *len);
 int amazon_exists_object(const char *bucket, const char *object);
 int amazon_delete_object(const char *bucket, const char *object);
+int amazon_delete_objects(const char *bucket, const char **object,
+                          uint32_t count);
+int amazon_delete_batch(const char *bucket, const char **object,
+                        uint32_t count);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Amazon request
@@ -87,6 +110,17 @@ int amazon_request_call(enum amazon_request_method method,
                         const char *bucket, const char *object,
                         const char *data, uint32_t data_len,
                         char **out_buf, uint32_t *out_len);
+bool amazon_request_retry(struct amazon_request *c);
+int amazon_request_result(struct amazon_request *c, char **out_buf,
+                          uint32_t *out_len);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous requests
+
+#if CURL_ASYNC
+int amazon_submit(struct store_async *req);
+void amazon_async_done(struct curl_async *async, CURLcode ret);
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Request initialization
@@ -101,6 +135,9 @@ void amazon_request_set_req(struct amazon_request *c, const char *data,
 // Section:     Generate and write request
 
 void amazon_request_perform(struct amazon_request *c);
+CURL *amazon_request_prepare(struct amazon_request *c);
+void amazon_request_finish(struct amazon_request *c, CURL *curl,
+                           CURLcode ret);
 char *amazon_request_access(struct amazon_request *c, const char *date,
                             const char *md5);
 
@@ -10,6 +10,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdarg.h>
+#include <inttypes.h>
+#include <time.h>
 #include <unistd.h>
 #include <netdb.h>
 #include <semaphore.h>
@@ -25,6 +27,7 @@
 #include "config.h"
 #include "log.h"
 #include "misc.h"
+#include "service/curl_util.h"
 #include "service/google.h"
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -36,26 +39,46 @@
 
 static CURLSH *curl_share = NULL;
 
-static sem_t curl_share_sem;
+static sem_t curl_share_sem[CURL_LOCK_DATA_LAST];
 
 static sem_t *curl_openssl_sem = NULL;
 
+static struct curl_pool curl_pool;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Multi interface
+
+#if CURL_ASYNC
+static CURLM *curl_multi = NULL;
+
+static struct curl_async *curl_async_head = NULL;
+
+static sem_t curl_async_lock;
+
+static pthread_t curl_async_id;
+
+static bool curl_async_running = false;
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Curl Init
 
 static void curl_share_lock(CURL *handle, curl_lock_data data,
                             curl_lock_access access, void *useptr) {
-  sem_wait(&curl_share_sem);
+  sem_wait(&curl_share_sem[data]);
 }
 
 static void curl_share_unlock(CURL *handle, curl_lock_data data, void *useptr) {
-  sem_post(&curl_share_sem);
+  sem_post(&curl_share_sem[data]);
 }
 
 void curl_load() {
+  uint32_t i;
+
   curl_global_init(CURL_GLOBAL_ALL);
 
-  sem_init(&curl_share_sem, 0, 1);
+  for (i = 0; i < CURL_LOCK_DATA_LAST; i++)
+    sem_init(&curl_share_sem[i], 0, 1);
   curl_share = curl_share_init();
   if (curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC,
                         curl_share_lock))
@@ -66,6 +89,30 @@ void curl_load() {
   if (curl_share_setopt(curl_share, CURLSHOPT_SHARE,
                         CURL_LOCK_DATA_DNS))
     error("curl_share_setopt failed");
+  if (curl_share_setopt(curl_share, CURLSHOPT_SHARE,
+                        CURL_LOCK_DATA_SSL_SESSION))
+    error("curl_share_setopt failed");
+#if LIBCURL_VERSION_NUM >= 0x073900
+  if (curl_share_setopt(curl_share, CURLSHOPT_SHARE,
+                        CURL_LOCK_DATA_CONNECT))
+    error("curl_share_setopt failed");
+#endif
+
+  curl_pool_load();
+
+#if CURL_ASYNC
+  sem_init(&curl_async_lock, 0, 1);
+#endif
+}
+
+void curl_unload() {
+#if CURL_ASYNC
+  curl_async_stop();
+#endif
+  curl_pool_unload();
+
+  curl_share_cleanup(curl_share);
+  curl_share = NULL;
 }
 
 static void curl_openssl_locking_function(int mode, int n, const char *file,
@@ -92,6 +139,212 @@ void curl_load_openssl() {
   CRYPTO_set_locking_callback(curl_openssl_locking_function);
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Handle pool
+
+void curl_pool_load() {
+  const char *size, *idle;
+
+  curl_pool.size = CURL_POOL_SIZE;
+  if ((size = config_get("curl-pool-size")))
+    curl_pool.size = strtoul(size, NULL, 10);
+
+  curl_pool.idle_timeout = CURL_POOL_IDLE_TIMEOUT;
+  if ((idle = config_get("curl-idle-timeout")))
+    curl_pool.idle_timeout = strtoul(idle, NULL, 10);
+
+  if (curl_pool.size &&
+      !(curl_pool.list = calloc(curl_pool.size, sizeof(*curl_pool.list))))
+    stderror("calloc");
+
+  curl_pool.count = 0;
+  curl_pool.reused = curl_pool.connected = 0;
+  sem_init(&curl_pool.lock, 0, 1);
+}
+
+void curl_pool_unload() {
+  uint32_t i;
+
+  notice("Curl connections: %" PRIu64 " reused, %" PRIu64 " new",
+         curl_pool.reused, curl_pool.connected);
+
+  for (i = 0; i < curl_pool.count; i++)
+    curl_easy_cleanup(curl_pool.list[i].curl);
+  free(curl_pool.list);
+  curl_pool.list = NULL;
+  curl_pool.count = 0;
+}
+
+static uint64_t curl_pool_now() {
+  struct timespec tm;
+
+  clock_gettime(CLOCK_MONOTONIC, &tm);
+  return tm.tv_sec;
+}
+
+CURL *curl_pool_take() {
+  struct curl_pool_entry stale[CURL_POOL_STALE_MAX];
+  uint32_t i, num_stale;
+  uint64_t now;
+  CURL *curl;
+
+  now = curl_pool_now();
+  curl = NULL;
+  num_stale = 0;
+
+  // Handles are kept as a stack, so the oldest ones sit at the bottom and
+  // are dropped together with their connections once they idle too long.
+  sem_wait(&curl_pool.lock);
+  while (curl_pool.count && num_stale < CURL_POOL_STALE_MAX &&
+         now - curl_pool.list[0].idle >= curl_pool.idle_timeout) {
+    stale[num_stale++] = curl_pool.list[0];
+    curl_pool.count--;
+    memmove(curl_pool.list, curl_pool.list + 1,
+            curl_pool.count * sizeof(*curl_pool.list));
+  }
+  if (curl_pool.count)
+    curl = curl_pool.list[--curl_pool.count].curl;
+  sem_post(&curl_pool.lock);
+
+  for (i = 0; i < num_stale; i++)
+    curl_easy_cleanup(stale[i].curl);
+
+  if (!curl && !(curl = curl_easy_init()))
+    error("Unable to init curl");
+
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
+  curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+  return curl;
+}
+
+void curl_pool_give(CURL *curl) {
+  // A reset keeps the live connections, session ids and DNS entries of the
+  // handle, only the options set for the last request are dropped.
+  curl_easy_reset(curl);
+
+  sem_wait(&curl_pool.lock);
+  if (curl_pool.count < curl_pool.size) {
+    curl_pool.list[curl_pool.count].curl = curl;
+    curl_pool.list[curl_pool.count].idle = curl_pool_now();
+    curl_pool.count++;
+    curl = NULL;
+  }
+  sem_post(&curl_pool.lock);
+
+  if (curl)
+    curl_easy_cleanup(curl);
+}
+
+CURLcode curl_pool_perform(CURL *curl) {
+  CURLcode ret;
+
+  if ((ret = curl_easy_perform(curl)) == CURLE_OK)
+    curl_pool_account(curl);
+  return ret;
+}
+
+void curl_pool_account(CURL *curl) {
+  long connects;
+
+  if (curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects) == CURLE_OK) {
+    if (connects)
+      __sync_add_and_fetch(&curl_pool.connected, 1);
+    else
+      __sync_add_and_fetch(&curl_pool.reused, 1);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Multi interface
+
+#if CURL_ASYNC
+void curl_async_submit(struct curl_async *a) {
+  curl_async_start();
+
+  sem_wait(&curl_async_lock);
+  a->next = curl_async_head;
+  curl_async_head = a;
+  sem_post(&curl_async_lock);
+
+  curl_multi_wakeup(curl_multi);
+}
+
+void curl_async_start() {
+  // Like the store threads this one is started on first use, so it is
+  // created in the process that stays around after forking.
+  if (curl_async_running)
+    return;
+
+  sem_wait(&curl_async_lock);
+  if (!curl_async_running) {
+    if (!(curl_multi = curl_multi_init()))
+      error("Unable to init curl multi");
+    curl_async_running = true;
+    if (pthread_create(&curl_async_id, NULL,
+                       (void *(*)(void*)) curl_async_thread, NULL) != 0)
+      error("Error creating curl thread");
+  }
+  sem_post(&curl_async_lock);
+}
+
+void curl_async_stop() {
+  if (!curl_async_running)
+    return;
+
+  curl_async_running = false;
+  curl_multi_wakeup(curl_multi);
+  pthread_join(curl_async_id, NULL);
+
+  curl_multi_cleanup(curl_multi);
+  curl_multi = NULL;
+}
+
+void curl_async_thread(void *__unused) {
+  struct curl_async *a, *next;
+  struct CURLMsg *msg;
+  uint32_t active;
+  int running, left;
+  CURLcode ret;
+
+  active = 0;
+  while (curl_async_running || active || curl_async_head) {
+    sem_wait(&curl_async_lock);
+    a = curl_async_head;
+    curl_async_head = NULL;
+    sem_post(&curl_async_lock);
+
+    for (; a; a = next) {
+      next = a->next;
+      curl_easy_setopt(a->curl, CURLOPT_PRIVATE, a);
+      if (curl_multi_add_handle(curl_multi, a->curl) != CURLM_OK) {
+        a->done(a, CURLE_FAILED_INIT);
+        continue;
+      }
+      active++;
+    }
+
+    curl_multi_perform(curl_multi, &running);
+
+    while ((msg = curl_multi_info_read(curl_multi, &left))) {
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char**) &a);
+      ret = msg->data.result;
+      curl_multi_remove_handle(curl_multi, a->curl);
+      active--;
+
+      if (ret == CURLE_OK)
+        curl_pool_account(a->curl);
+      a->done(a, ret);
+    }
+
+    if (active || curl_async_running)
+      curl_multi_poll(curl_multi, NULL, 0, CURL_ASYNC_POLL_MS, NULL);
+  }
+}
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Getters
 
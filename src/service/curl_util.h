@@ -9,14 +9,79 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Required includes
 
+#include <stdint.h>
+#include <semaphore.h>
 #include <curl/curl.h>
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define CURL_POOL_SIZE          32
+#define CURL_POOL_IDLE_TIMEOUT  60
+#define CURL_POOL_STALE_MAX     8
+
+#define CURL_ASYNC_POLL_MS      1000
+
+// The multi thread sleeps in curl_multi_poll and is woken by
+// curl_multi_wakeup, both new in libcurl 7.68. Older versions leave every
+// asynchronous request to the store threads.
+#define CURL_ASYNC              (LIBCURL_VERSION_NUM >= 0x074400)
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Handle pool
+
+struct curl_pool_entry {
+  CURL *curl;
+  uint64_t idle;
+};
+
+struct curl_pool {
+  struct curl_pool_entry *list;
+  uint32_t size, count, idle_timeout;
+  uint64_t reused, connected;
+  sem_t lock;
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Multi interface
+
+#if CURL_ASYNC
+// A transfer handed to the multi thread, done is called from that thread
+// once the transfer is removed from the multi handle.
+struct curl_async {
+  CURL *curl;
+  void (*done)(struct curl_async *a, CURLcode ret);
+  struct curl_async *next;
+};
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Curl Init
 
 void curl_load();
+void curl_unload();
 void curl_load_openssl();
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Handle pool
+
+void curl_pool_load();
+void curl_pool_unload();
+CURL *curl_pool_take();
+void curl_pool_give(CURL *curl);
+CURLcode curl_pool_perform(CURL *curl);
+void curl_pool_account(CURL *curl);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Multi interface
+
+#if CURL_ASYNC
+void curl_async_submit(struct curl_async *a);
+void curl_async_start();
+void curl_async_stop();
+void curl_async_thread(void *__unused);
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Getters
 
@@ -31,6 +31,7 @@ const struct store_intr dummy_intr = {
   .delete_bucket  = dummy_delete_bucket,
 
   .list_object    = dummy_list_object,
+  .list_page      = dummy_list_page,
   .put_object     = dummy_put_object,
   .get_object     = dummy_get_object,
   .exists_object  = dummy_exists_object,
@@ -120,9 +121,9 @@ int dummy_delete_bucket(const char *bucket) {
 int dummy_list_object(const char *bucket, const char *prefix,
                       uint32_t max_count, struct store_list *list) {
   char fname[DUMMY_MAX_PATH];
-  DIR *dir;
-  struct dirent *ent;
+  struct dirent **ent;
   uint32_t count;
+  int i, n;
 
   assert(bucket != NULL);
 
@@ -131,25 +132,79 @@ int dummy_list_object(const char *bucket, const char *prefix,
     return USER_ERROR;
   }
 
+  // Sorted like the real services, so a listing can be continued from the
+  // last key it returned.
   snprintf(fname, sizeof(fname), "%s/%s", dummy_path, bucket);
-  if (!(dir = opendir(fname))) {
+  if ((n = scandir(fname, &ent, NULL, alphasort)) < 0) {
     if (errno == ENOENT)
       return NOT_FOUND;
-    stdwarning("opendir");
+    stdwarning("scandir");
     return SYS_ERROR;
   }
 
   count = 0;
-  while (count < max_count && (ent = readdir(dir))) {
-    if (ent->d_type != DT_REG)
-      continue;
-    if (prefix && strncmp(ent->d_name, prefix, strlen(prefix)) < 0)
-      continue;
-    store_list_push(list, ent->d_name);
-    count++;
+  for (i = 0; i < n; i++) {
+    if (count < max_count && ent[i]->d_type == DT_REG &&
+        !(prefix && strncmp(ent[i]->d_name, prefix, strlen(prefix)) < 0)) {
+      store_list_push(list, ent[i]->d_name);
+      count++;
+    }
+    free(ent[i]);
   }
 
-  closedir(dir);
+  free(ent);
+  return SUCCESS;
+}
+
+int dummy_list_page(const char *bucket, const char *prefix,
+                    const char *after, char **token,
+                    uint32_t max_count, struct store_list *list) {
+  char fname[DUMMY_MAX_PATH], *from;
+  struct dirent **ent;
+  uint32_t count, prefix_len;
+  int i, n;
+
+  assert(bucket != NULL);
+
+  if (strchr(bucket, '/')) {
+    warning("Bucket contains invalid '/' character");
+    return USER_ERROR;
+  }
+
+  snprintf(fname, sizeof(fname), "%s/%s", dummy_path, bucket);
+  if ((n = scandir(fname, &ent, NULL, alphasort)) < 0) {
+    if (errno == ENOENT)
+      return NOT_FOUND;
+    stdwarning("scandir");
+    return SYS_ERROR;
+  }
+
+  // The token is simply the last key handed out.
+  from = *token;
+  *token = NULL;
+  if (!from && after && !(from = strdup(after)))
+    stderror("strdup");
+
+  prefix_len = strlen(prefix);
+  count = 0;
+  for (i = 0; i < n; i++) {
+    if (ent[i]->d_type == DT_REG &&
+        !strncmp(ent[i]->d_name, prefix, prefix_len) &&
+        !(from && strcmp(ent[i]->d_name, from) <= 0)) {
+      if (count < max_count) {
+        store_list_push(list, ent[i]->d_name);
+        count++;
+      } else if (!*token && count) {
+        if (!(*token = strdup(list->item[list->size - 1])))
+          stderror("strdup");
+      }
+    }
+    free(ent[i]);
+  }
+
+  if (from)
+    free(from);
+  free(ent);
   return SUCCESS;
 }
 
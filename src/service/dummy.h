@@ -39,6 +39,9 @@ int dummy_delete_bucket(const char *bucket);
 
 int dummy_list_object(const char *bucket, const char *prefix,
                       uint32_t max_count, struct store_list *list);
+int dummy_list_page(const char *bucket, const char *prefix,
+                    const char *after, char **token,
+                    uint32_t max_count, struct store_list *list);
 int dummy_put_object(const char *bucket, const char *object,
                      const char *buf, uint32_t len);
 int dummy_get_object(const char *bucket, const char *object,
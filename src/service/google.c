@@ -40,16 +40,23 @@
 
 const struct store_intr google_intr = {
   .load           = google_load,
+  .unload         = google_unload,
 
   .create_bucket  = google_create_bucket,
   .exists_bucket  = google_exists_bucket,
   .delete_bucket  = google_delete_bucket,
 
   .list_object    = google_list_object,
+  .list_page      = google_list_page,
   .put_object     = google_put_object,
   .get_object     = google_get_object,
   .exists_object  = google_exists_object,
   .delete_object  = google_delete_object,
+  .delete_objects = google_delete_objects,
+
+#if CURL_ASYNC
+  .submit         = google_submit,
+#endif
 };
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -97,6 +104,10 @@ void google_load() {
   }
 }
 
+void google_unload() {
+  curl_unload();
+}
+
 FILE *google_open_token_file(const char *mode) {
   const char *token_file;
   FILE *file;
@@ -183,17 +194,14 @@ bool google_get_token(const char *key, bool refresh) {
              key);
   }
 
-  if (!(curl = curl_easy_init()))
-    error("Unable to init curl");
+  curl = curl_pool_take();
   curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
-  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-  curl_easy_setopt(curl, CURLOPT_SHARE, curl_share_get());
   curl_easy_setopt(curl, CURLOPT_URL,
                    "https://accounts.google.com/o/oauth2/token");
   curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, json_write_callback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, &write_buf);
-  ret = curl_easy_perform(curl);
+  ret = curl_pool_perform(curl);
   if (ret != CURLE_OK) {
     error("Curl failed: %s", curl_easy_strerror(ret));
   } else {
@@ -215,10 +223,10 @@ bool google_get_token(const char *key, bool refresh) {
     sem_post(&google_access_token_sem);
   }
 
+  curl_pool_give(curl);
   free(data);
   if (write_buf.buf)
     free(write_buf.buf);
-  curl_easy_cleanup(curl);
   return ret == CURLE_OK;
 }
 
@@ -291,6 +299,54 @@ int google_list_object(const char *bucket, const char *prefix,
   return ret;
 }
 
+int google_list_page(const char *bucket, const char *prefix,
+                     const char *after, char **token,
+                     uint32_t max_count, struct store_list *list) {
+  char *url = NULL, *esc_prefix, *esc_from;
+  const char *next, *name;
+  map_t json, item;
+  int ret;
+
+  // The first page starts at the given key, startOffset includes the key
+  // itself so it is skipped below.
+  esc_prefix = curl_easy_escape(NULL, prefix, 0);
+  esc_from = NULL;
+  if (*token)
+    esc_from = curl_easy_escape(NULL, *token, 0);
+  else if (after)
+    esc_from = curl_easy_escape(NULL, after, 0);
+
+  asprintf(&url, "/storage/v1/b/%s/o?prefix=%s&maxResults=%u%s%s", bucket,
+           esc_prefix, max_count,
+           !esc_from ? "" : *token ? "&pageToken=" : "&startOffset=",
+           esc_from ?: "");
+  curl_free(esc_prefix);
+  if (esc_from)
+    curl_free(esc_from);
+
+  ret = google_api_call("GET", url, 0, NULL, 0, NULL, 0, &json);
+  free(url);
+
+  if (*token) {
+    free(*token);
+    *token = NULL;
+  }
+  if (ret != SUCCESS)
+    return ret;
+
+  map_foreach_under(item, json, "items") {
+    if ((name = map_get_str(item, "name")) &&
+        !(after && strcmp(name, after) <= 0))
+      store_list_push(list, name);
+  }
+  if ((next = map_get_str(json, "nextPageToken")) &&
+      !(*token = strdup(next)))
+    stderror("strdup");
+
+  map_free(json);
+  return SUCCESS;
+}
+
 int google_put_object(const char *bucket, const char *object,
                       const char *buf, uint32_t len) {
   char *url = NULL;
@@ -334,6 +390,70 @@ int google_delete_object(const char *bucket, const char *object) {
   return ret;
 }
 
+int google_delete_objects(const char *bucket, const char **object,
+                          uint32_t count) {
+  uint32_t i;
+  int ret;
+
+  for (i = 0; i < count; i += GOOGLE_DELETE_BATCH) {
+    if ((ret = google_delete_batch(bucket, object + i,
+                                   min(count - i, GOOGLE_DELETE_BATCH))) !=
+        SUCCESS)
+      return ret;
+  }
+  return SUCCESS;
+}
+
+int google_delete_batch(const char *bucket, const char **object,
+                        uint32_t count) {
+  FILE *body_file;
+  char *body, *resp, *ptr, *end;
+  size_t body_len;
+  uint32_t i, resp_len;
+  long code;
+  int ret;
+
+  if (!(body_file = open_memstream(&body, &body_len)))
+    stderror("open_memstream");
+  for (i = 0; i < count; i++) {
+    fprintf(body_file,
+            "--" GOOGLE_BATCH_BOUNDARY "\r\n"
+            "Content-Type: application/http\r\n"
+            "Content-ID: <%u>\r\n"
+            "\r\n"
+            "DELETE /storage/v1/b/%s/o/%s HTTP/1.1\r\n"
+            "\r\n",
+            i, bucket, object[i]);
+  }
+  fprintf(body_file, "--" GOOGLE_BATCH_BOUNDARY "--\r\n");
+  fclose(body_file);
+
+  resp = NULL;
+  resp_len = 0;
+  ret = google_api_call("POST", "/batch/storage/v1", GOOGLE_API_REQUEST_BATCH,
+                        body, body_len, &resp, &resp_len, NULL);
+
+  // Every part of the response carries the status line of one delete,
+  // objects that were already gone count as deleted.
+  if (ret == SUCCESS && resp) {
+    for (ptr = resp, end = resp + resp_len;
+         (ptr = memmem(ptr, end - ptr, "HTTP/1.1 ", 9));
+         ptr += 9) {
+      code = strtol(ptr + 9, NULL, 10);
+      if (code != 200 && code != 204 && code != 404) {
+        warning("Google Cloud Storage failed to delete some objects");
+        ret = SYS_ERROR;
+        break;
+      }
+    }
+  }
+
+  free(body);
+  if (resp)
+    free(resp);
+  return ret;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Google API
 
@@ -358,7 +478,7 @@ int google_api_call(const char *method, const char *url, uint32_t flags,
     c->req_left = req_len;
     c->resp_code = 500;
     google_api_perform(c);
-    should_retry = false;
+    should_retry = google_api_retry(c);
     switch (c->resp_code) {
       case 200:
       case 204:
@@ -379,10 +499,6 @@ int google_api_call(const char *method, const char *url, uint32_t flags,
       case 401:
         if (!google_request_auth_token())
           warning("Failed to get google authorization token");
-
-      case 500:
-      case 503:
-        should_retry = true;
         break;
 
       case 404:
@@ -401,17 +517,35 @@ int google_api_call(const char *method, const char *url, uint32_t flags,
   return ret;
 }
 
+bool google_api_retry(struct google_api_request *c) {
+  switch (c->resp_code) {
+    case 401:
+    case 500:
+    case 503:
+      return true;
+  }
+  return false;
+}
+
 void google_api_perform(struct google_api_request *c) {
   CURL *curl;
   CURLcode ret;
+
+  curl = google_api_prepare(c);
+
+  if ((ret = curl_pool_perform(curl)) != CURLE_OK)
+    warning("Curl failed: %s", curl_easy_strerror(ret));
+
+  google_api_finish(c, curl, ret);
+}
+
+CURL *google_api_prepare(struct google_api_request *c) {
+  CURL *curl;
   struct curl_slist *header;
   char dig[MD5_DIGEST_LENGTH], *md5, *host;
 
-  if (!(curl = curl_easy_init()))
-    error("Unable to init curl");
+  curl = curl_pool_take();
   curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, false);
-  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1);
-  curl_easy_setopt(curl, CURLOPT_SHARE, curl_share_get());
   curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, c->method);
   if (!strcasecmp(c->method, "HEAD"))
     curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
@@ -433,6 +567,9 @@ void google_api_perform(struct google_api_request *c) {
   sem_post(&google_access_token_sem);
   if ((c->flags & GOOGLE_API_REQUEST_JSON))
     set_header("Content-Type", "application/json");
+  if ((c->flags & GOOGLE_API_REQUEST_BATCH))
+    set_header("Content-Type", "multipart/mixed; boundary=%s",
+               GOOGLE_BATCH_BOUNDARY);
   if ((c->flags & GOOGLE_API_REQUEST_MD5)) {
     MD5((uint8_t *)c->req_data, c->req_len, (uint8_t *)dig);
     base64_encode(dig, sizeof(dig), &md5);
@@ -451,15 +588,129 @@ void google_api_perform(struct google_api_request *c) {
   curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, google_api_write_callback);
   curl_easy_setopt(curl, CURLOPT_WRITEDATA, c);
 
-  if ((ret = curl_easy_perform(curl)) != CURLE_OK) {
+  c->header = header;
+  return curl;
+}
+
+void google_api_finish(struct google_api_request *c, CURL *curl,
+                       CURLcode ret) {
+  if (ret == CURLE_OK)
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &c->resp_code);
+
+  curl_pool_give(curl);
+  curl_slist_free_all(c->header);
+  c->header = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous requests
+
+#if CURL_ASYNC
+int google_submit(struct store_async *req) {
+  struct google_async *a;
+  const char *method;
+  uint32_t flags;
+  int ret;
+
+  if (!(a = calloc(sizeof(*a), 1)))
+    stderror("calloc");
+
+  flags = 0;
+  switch (req->op) {
+    case STORE_ASYNC_PUT:
+      method = "POST";
+      flags = GOOGLE_API_REQUEST_MD5;
+      ret = asprintf(&a->url, "/upload/storage/v1/b/%s/o?name=%s",
+                     req->bucket, req->object);
+      break;
+
+    case STORE_ASYNC_GET:
+      method = "GET";
+      ret = asprintf(&a->url, "/storage/v1/b/%s/o/%s?alt=media",
+                     req->bucket, req->object);
+      break;
+
+    case STORE_ASYNC_EXISTS:
+      method = "GET";
+      ret = asprintf(&a->url, "/storage/v1/b/%s/o/%s",
+                     req->bucket, req->object);
+      break;
+
+    case STORE_ASYNC_DELETE:
+      method = "DELETE";
+      ret = asprintf(&a->url, "/storage/v1/b/%s/o/%s",
+                     req->bucket, req->object);
+      break;
+
+    default:
+      free(a);
+      return USER_ERROR;
+  }
+  if (ret < 0)
+    stderror("asprintf");
+
+  a->req = req;
+  a->c.method = method;
+  a->c.url = a->url;
+  a->c.flags = flags;
+  if (req->op == STORE_ASYNC_PUT) {
+    a->c.req_data = req->data;
+    a->c.req_ptr = req->data;
+    a->c.req_len = req->len;
+    a->c.req_left = req->len;
+  }
+  a->c.resp_code = 500;
+
+  a->async.curl = google_api_prepare(&a->c);
+  a->async.done = google_async_done;
+  curl_async_submit(&a->async);
+  return SUCCESS;
+}
+
+void google_async_done(struct curl_async *async, CURLcode ret) {
+  struct google_async *a;
+  struct store_async *req;
+
+  a = (struct google_async*) async;
+  req = a->req;
+
+  if (ret != CURLE_OK)
     warning("Curl failed: %s", curl_easy_strerror(ret));
+  google_api_finish(&a->c, async->curl, ret);
+
+  // Refreshing the token and backing off both block, the blocking path
+  // takes care of them.
+  if (google_api_retry(&a->c)) {
+    store_async_defer(req);
   } else {
-    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &c->resp_code);
+    switch (a->c.resp_code) {
+      case 200:
+      case 204:
+        req->ret = SUCCESS;
+        if (req->op == STORE_ASYNC_GET) {
+          req->buf = a->c.resp_data;
+          req->len = a->c.resp_len;
+          a->c.resp_data = NULL;
+        }
+        break;
+
+      case 404:
+        req->ret = NOT_FOUND;
+        break;
+
+      default:
+        req->ret = SYS_ERROR;
+        break;
+    }
+    req->complete(req);
   }
 
-  curl_slist_free_all(header);
-  curl_easy_cleanup(curl);
+  if (a->c.resp_data)
+    free(a->c.resp_data);
+  free(a->url);
+  free(a);
 }
+#endif
 
 size_t google_api_read_callback(void *ptr, size_t size, size_t nmemb,
                                 void *stream) {
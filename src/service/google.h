@@ -14,6 +14,7 @@
 #include <stdbool.h>
 #include "store.h"
 #include "service/map.h"
+#include "service/curl_util.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Service table
@@ -31,11 +32,14 @@ extern const struct store_intr google_intr;
 #define GOOGLE_REFRESH_TOKEN_SIZE (1 << 10)
 
 #define GOOGLE_API_REQUEST_RETRY  12
+#define GOOGLE_DELETE_BATCH       100
+#define GOOGLE_BATCH_BOUNDARY     "cloudfs_batch"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Load
 
 void google_load();
+void google_unload();
 FILE *google_open_token_file(const char *mode);
 void google_request_refresh_token();
 bool google_request_auth_token();
@@ -53,12 +57,19 @@ int google_delete_bucket(const char *bucket);
 
 int google_list_object(const char *bucket, const char *prefix,
                        uint32_t max_count, struct store_list *list);
+int google_list_page(const char *bucket, const char *prefix,
+                     const char *after, char **token,
+                     uint32_t max_count, struct store_list *list);
 int google_put_object(const char *bucket, const char *object,
                       const char *buf, uint32_t len);
 int google_get_object(const char *bucket, const char *object,
                       char **buf, uint32_t *len);
 int google_exists_object(const char *bucket, const char *object);
 int google_delete_object(const char *bucket, const char *object);
+int google_delete_objects(const char *bucket, const char **object,
+                          uint32_t count);
+int google_delete_batch(const char *bucket, const char **object,
+                        uint32_t count);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Google API
@@ -66,6 +77,7 @@ int google_delete_object(const char *bucket, const char *object);
 enum google_api_request_flags {
   GOOGLE_API_REQUEST_JSON = 1 << 0,
   GOOGLE_API_REQUEST_MD5 = 1 << 1,
+  GOOGLE_API_REQUEST_BATCH = 1 << 2,
 };
 
 struct google_api_request {
@@ -78,15 +90,40 @@ struct google_api_request {
   char *resp_data;
   uint32_t resp_len;
   long resp_code;
+
+  struct curl_slist *header;
+};
+
+#if CURL_ASYNC
+// The curl transfer comes first so the done callback can cast back to the
+// request it belongs to.
+struct google_async {
+  struct curl_async async;
+  struct google_api_request c;
+  struct store_async *req;
+  char *url;
 };
+#endif
 
 int google_api_call(const char *method, const char *url, uint32_t flags,
                     const char *req_data, uint32_t req_len, char **resp_data,
                     uint32_t *resp_len, map_t *json);
+bool google_api_retry(struct google_api_request *c);
 void google_api_perform(struct google_api_request *c);
+CURL *google_api_prepare(struct google_api_request *c);
+void google_api_finish(struct google_api_request *c, CURL *curl,
+                       CURLcode ret);
 size_t google_api_read_callback(void *ptr, size_t size, size_t nmemb,
                                 void *stream);
 size_t google_api_write_callback(void *ptr, size_t size, size_t nmemb,
                                  void *stream);
 void google_api_request_free(struct google_api_request *c);
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous requests
+
+#if CURL_ASYNC
+int google_submit(struct store_async *req);
+void google_async_done(struct curl_async *async, CURLcode ret);
+#endif
+
@@ -7,6 +7,11 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include "config.h"
 #include "log.h"
 #include "misc.h"
@@ -32,11 +37,45 @@ static const struct store_intr *store_intr_ptr = NULL;
 
 static bool store_readonly = false;
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous request threads
+
+static struct store_async *store_async_head = NULL,
+                          *store_async_tail = NULL;
+
+static sem_t store_async_lock,
+             store_async_wake;
+
+static pthread_t *store_async_thread_id = NULL;
+
+static uint32_t store_async_thread_count = 0;
+
+static bool store_async_running = false;
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Hedged request state
+
+static double store_hedge_percentile = 0;
+
+static uint32_t store_hedge_budget = STORE_HEDGE_BUDGET;
+
+static uint64_t store_hedge_hist[STORE_HEDGE_BUCKETS],
+                store_hedge_samples = 0,
+                store_hedge_delay = 0,
+                store_hedge_tokens = 0;
+
+static uint64_t store_hedge_gets = 0,
+                store_hedge_sent = 0,
+                store_hedge_won = 0,
+                store_hedge_denied = 0;
+
+static sem_t store_hedge_lock;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Storage construction / destruction
 
 void store_load() {
-  const char *intr;
+  const char *intr, *threads, *hedge;
   const struct store_intr_opt *opt, *opt_end;
 
   if (!(intr = config_get("store")))
@@ -60,11 +99,47 @@ void store_load() {
   if (!store_intr_ptr)
     error("Invalid storage service specified \"%s\"", intr);
 
+  store_async_thread_count = STORE_ASYNC_THREADS;
+  if ((threads = config_get("store-async-threads"))) {
+    store_async_thread_count = strtoul(threads, NULL, 10);
+    if (store_async_thread_count < 1 ||
+        store_async_thread_count > STORE_ASYNC_MAX_THREADS)
+      error("Store async threads must be between 1 and %d",
+            STORE_ASYNC_MAX_THREADS);
+  }
+  sem_init(&store_async_lock, 0, 1);
+  sem_init(&store_async_wake, 0, 0);
+
+  store_hedge_percentile = 0;
+  if ((hedge = config_get("hedge-percentile"))) {
+    store_hedge_percentile = strtod(hedge, NULL);
+    if (store_hedge_percentile <= 0 || store_hedge_percentile >= 100)
+      error("Hedge percentile must be between 0 and 100");
+  }
+  store_hedge_budget = STORE_HEDGE_BUDGET;
+  if ((hedge = config_get("hedge-budget"))) {
+    store_hedge_budget = strtoul(hedge, NULL, 10);
+    if (store_hedge_budget > 100)
+      error("Hedge budget must be a percentage of reads");
+  }
+  memset(store_hedge_hist, 0, sizeof(store_hedge_hist));
+  store_hedge_samples = store_hedge_delay = store_hedge_tokens = 0;
+  store_hedge_gets = store_hedge_sent = 0;
+  store_hedge_won = store_hedge_denied = 0;
+  sem_init(&store_hedge_lock, 0, 1);
+
   if (store_intr_ptr->load)
     store_intr_ptr->load();
 }
 
 void store_unload() {
+  if (store_hedge_percentile > 0)
+    notice("Hedged reads: %" PRIu64 " of %" PRIu64 " sent, %" PRIu64 " won, "
+           "%" PRIu64 " over budget, delay %" PRIu64 "ms",
+           store_hedge_sent, store_hedge_gets, store_hedge_won,
+           store_hedge_denied, store_hedge_delay / 1000);
+
+  store_async_stop();
   if (store_intr_ptr && store_intr_ptr->unload)
     store_intr_ptr->unload();
   store_intr_ptr = NULL;
@@ -94,6 +169,16 @@ int store_list_object(const char *bucket, const char *prefix,
   return store_intr_ptr->list_object(bucket, prefix, max_count, list);
 }
 
+int store_list_page(const char *bucket, const char *prefix,
+                    const char *after, char **token,
+                    uint32_t max_count, struct store_list *list) {
+  assert(bucket != NULL && prefix != NULL && token != NULL);
+  if (!store_intr_ptr->list_page)
+    return USER_ERROR;
+  return store_intr_ptr->list_page(bucket, prefix, after, token,
+                                   max_count, list);
+}
+
 int store_put_object(const char *bucket, const char *object,
                      const char *buf, uint32_t len) {
   assert(bucket != NULL && object != NULL);
@@ -103,6 +188,8 @@ int store_put_object(const char *bucket, const char *object,
 int store_get_object(const char *bucket, const char *object,
                      char **buf, uint32_t *len) {
   assert(bucket != NULL && object != NULL);
+  if (store_hedge_percentile > 0)
+    return store_hedge_get(bucket, object, buf, len);
   return store_intr_ptr->get_object(bucket, object, buf, len);
 }
 
@@ -116,6 +203,561 @@ int store_delete_object(const char *bucket, const char *object) {
   return store_intr_ptr->delete_object(bucket, object);
 }
 
+int store_delete_objects(const char *bucket, const char **object,
+                         uint32_t count) {
+  assert(bucket != NULL && (object != NULL || !count));
+
+  if (!count)
+    return SUCCESS;
+  if (store_intr_ptr->delete_objects)
+    return store_intr_ptr->delete_objects(bucket, object, count);
+  return store_async_delete_objects(bucket, object, count);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous requests
+
+void store_submit(struct store_async *req) {
+  assert(req->bucket != NULL && req->object != NULL && req->complete);
+
+  req->buf = NULL;
+  if (store_intr_ptr->submit && store_intr_ptr->submit(req) == SUCCESS)
+    return;
+  store_async_defer(req);
+}
+
+void store_async_defer(struct store_async *req) {
+  // Services without an asynchronous path, and requests they give up on
+  // such as ones that need a retry with backoff, run the blocking call on
+  // one of the store threads.
+  store_async_start();
+
+  req->next = NULL;
+  sem_wait(&store_async_lock);
+  if (store_async_tail)
+    store_async_tail->next = req;
+  else
+    store_async_head = req;
+  store_async_tail = req;
+  sem_post(&store_async_lock);
+
+  sem_post(&store_async_wake);
+}
+
+void store_async_start() {
+  pthread_attr_t pattr;
+  uint32_t i;
+
+  // Threads are only started on first use, the process may still fork into
+  // the background after the store is loaded.
+  if (store_async_running)
+    return;
+
+  sem_wait(&store_async_lock);
+  if (!store_async_running) {
+    if (!(store_async_thread_id = calloc(store_async_thread_count,
+                                         sizeof(*store_async_thread_id))))
+      stderror("calloc");
+
+    pthread_attr_init(&pattr);
+    pthread_attr_setstacksize(&pattr, STORE_ASYNC_THREAD_STACK_SIZE);
+    for (i = 0; i < store_async_thread_count; i++) {
+      if (pthread_create(&store_async_thread_id[i], &pattr,
+                         (void *(*)(void*)) store_async_thread, NULL) != 0)
+        error("Error creating store thread");
+    }
+    pthread_attr_destroy(&pattr);
+
+    store_async_running = true;
+  }
+  sem_post(&store_async_lock);
+}
+
+void store_async_stop() {
+  uint32_t i;
+
+  if (!store_async_running)
+    return;
+
+  store_async_running = false;
+  for (i = 0; i < store_async_thread_count; i++)
+    sem_post(&store_async_wake);
+  for (i = 0; i < store_async_thread_count; i++)
+    pthread_join(store_async_thread_id[i], NULL);
+
+  free(store_async_thread_id);
+  store_async_thread_id = NULL;
+}
+
+void store_async_run(struct store_async *req) {
+  switch (req->op) {
+    case STORE_ASYNC_PUT:
+      req->ret = store_put_object(req->bucket, req->object,
+                                  req->data, req->len);
+      break;
+
+    case STORE_ASYNC_GET:
+      // Hedged gets come through here, they must not hedge again.
+      req->ret = store_intr_ptr->get_object(req->bucket, req->object,
+                                            &req->buf, &req->len);
+      break;
+
+    case STORE_ASYNC_EXISTS:
+      req->ret = store_exists_object(req->bucket, req->object);
+      break;
+
+    case STORE_ASYNC_DELETE:
+      req->ret = store_delete_object(req->bucket, req->object);
+      break;
+
+    default:
+      req->ret = USER_ERROR;
+      break;
+  }
+  req->complete(req);
+}
+
+void store_async_thread(void *__unused) {
+  struct store_async *req;
+
+  while (true) {
+    sem_wait(&store_async_wake);
+
+    sem_wait(&store_async_lock);
+    if ((req = store_async_head)) {
+      if (!(store_async_head = req->next))
+        store_async_tail = NULL;
+    }
+    sem_post(&store_async_lock);
+
+    if (req)
+      store_async_run(req);
+    else if (!store_async_running)
+      break;
+  }
+}
+
+int store_async_delete_objects(const char *bucket, const char **object,
+                               uint32_t count) {
+  struct store_async *req;
+  struct store_async_wait wait;
+  uint32_t i;
+
+  // Services without a batch call still get all the deletes in flight at
+  // once, an object that is already gone counts as deleted.
+  if (!(req = calloc(count, sizeof(*req))))
+    stderror("calloc");
+
+  sem_init(&wait.done, 0, 0);
+  wait.ret = SUCCESS;
+  for (i = 0; i < count; i++) {
+    req[i].op = STORE_ASYNC_DELETE;
+    req[i].bucket = bucket;
+    req[i].object = object[i];
+    req[i].complete = store_async_delete_complete;
+    req[i].arg = &wait;
+    store_submit(&req[i]);
+  }
+  for (i = 0; i < count; i++)
+    sem_wait(&wait.done);
+  sem_destroy(&wait.done);
+
+  free(req);
+  return wait.ret;
+}
+
+void store_async_delete_complete(struct store_async *req) {
+  struct store_async_wait *wait;
+
+  wait = req->arg;
+  if (req->ret != SUCCESS && req->ret != NOT_FOUND)
+    wait->ret = req->ret;
+  sem_post(&wait->done);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Hedged requests
+
+int store_hedge_get(const char *bucket, const char *object,
+                    char **buf, uint32_t *len) {
+  struct store_hedge *hedge;
+  struct store_async *req;
+  struct timespec deadline;
+  uint64_t delay;
+  uint32_t i;
+  bool send;
+  int ret;
+
+  if (!(hedge = calloc(sizeof(*hedge), 1)))
+    stderror("calloc");
+
+  // The names are copied, a losing request may still be in flight after
+  // the caller has moved on.
+  if (!(hedge->bucket = strdup(bucket)) || !(hedge->object = strdup(object)))
+    stderror("strdup");
+  for (i = 0; i < sizearr(hedge->req); i++) {
+    hedge->req[i].op = STORE_ASYNC_GET;
+    hedge->req[i].bucket = hedge->bucket;
+    hedge->req[i].object = hedge->object;
+    hedge->req[i].complete = store_hedge_complete;
+    hedge->req[i].arg = hedge;
+  }
+  hedge->refs = 2;
+  hedge->outstanding = 1;
+  hedge->winner = -1;
+  sem_init(&hedge->lock, 0, 1);
+  sem_init(&hedge->done, 0, 0);
+
+  // Every read earns a share of a hedge, so the extra requests stay within
+  // the budget but may come in short bursts.
+  sem_wait(&store_hedge_lock);
+  store_hedge_gets++;
+  store_hedge_tokens = min(store_hedge_tokens + store_hedge_budget,
+                           STORE_HEDGE_BURST * 100);
+  delay = store_hedge_delay;
+  sem_post(&store_hedge_lock);
+
+  hedge->start = store_hedge_now();
+  store_submit(&hedge->req[0]);
+
+  if (delay) {
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += delay / 1000000;
+    deadline.tv_nsec += (delay % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    while ((ret = sem_timedwait(&hedge->done, &deadline)) && errno == EINTR);
+
+    if (ret) {
+      sem_wait(&hedge->lock);
+      if ((send = hedge->winner < 0 && store_hedge_take())) {
+        hedge->refs++;
+        hedge->outstanding++;
+      }
+      sem_post(&hedge->lock);
+
+      if (send)
+        store_submit(&hedge->req[1]);
+      sem_wait(&hedge->done);
+    }
+  } else
+    sem_wait(&hedge->done);
+
+  req = &hedge->req[hedge->winner];
+  if (hedge->winner)
+    __sync_add_and_fetch(&store_hedge_won, 1);
+  *buf = req->buf;
+  *len = req->len;
+  ret = req->ret;
+  req->buf = NULL;
+
+  store_hedge_release(hedge);
+  return ret;
+}
+
+void store_hedge_complete(struct store_async *req) {
+  struct store_hedge *hedge;
+
+  hedge = req->arg;
+
+  // Only the first copy is timed, the hedge starts late and would drag the
+  // percentile down.
+  if (req == &hedge->req[0] && req->ret != SYS_ERROR)
+    store_hedge_record(store_hedge_now() - hedge->start);
+
+  // A failure only answers the read if there is nothing left to wait for,
+  // the other copy may still get through.
+  sem_wait(&hedge->lock);
+  hedge->outstanding--;
+  if (hedge->winner < 0 &&
+      (req->ret != SYS_ERROR || !hedge->outstanding)) {
+    hedge->winner = req - hedge->req;
+    sem_post(&hedge->done);
+  } else if (req->buf) {
+    free(req->buf);
+    req->buf = NULL;
+  }
+  sem_post(&hedge->lock);
+
+  store_hedge_release(hedge);
+}
+
+void store_hedge_release(struct store_hedge *hedge) {
+  bool last;
+
+  sem_wait(&hedge->lock);
+  last = !--hedge->refs;
+  sem_post(&hedge->lock);
+
+  if (!last)
+    return;
+  sem_destroy(&hedge->lock);
+  sem_destroy(&hedge->done);
+  free(hedge->bucket);
+  free(hedge->object);
+  free(hedge);
+}
+
+bool store_hedge_take() {
+  bool ret;
+
+  sem_wait(&store_hedge_lock);
+  if ((ret = store_hedge_tokens >= 100)) {
+    store_hedge_tokens -= 100;
+    store_hedge_sent++;
+  } else
+    store_hedge_denied++;
+  sem_post(&store_hedge_lock);
+  return ret;
+}
+
+void store_hedge_record(uint64_t usec) {
+  uint64_t target, sum;
+  uint32_t i;
+
+  sem_wait(&store_hedge_lock);
+
+  // Halving the counts once the window fills lets the delay follow the
+  // service as it speeds up or slows down.
+  if (store_hedge_samples >= STORE_HEDGE_WINDOW) {
+    for (i = 0, store_hedge_samples = 0; i < STORE_HEDGE_BUCKETS; i++)
+      store_hedge_samples += (store_hedge_hist[i] /= 2);
+  }
+  store_hedge_hist[store_hedge_bucket(usec)]++;
+  store_hedge_samples++;
+
+  if (store_hedge_samples >= STORE_HEDGE_MIN_SAMPLES) {
+    target = store_hedge_samples * store_hedge_percentile / 100;
+    for (i = 0, sum = 0; i < STORE_HEDGE_BUCKETS - 1; i++) {
+      if ((sum += store_hedge_hist[i]) > target)
+        break;
+    }
+    store_hedge_delay = max(store_hedge_bucket_usec(i + 1),
+                            STORE_HEDGE_MIN_DELAY);
+  }
+
+  sem_post(&store_hedge_lock);
+}
+
+uint32_t store_hedge_bucket(uint64_t usec) {
+  uint32_t bit;
+
+  // Four buckets for every power of two, good to within a fifth of the
+  // latency over the whole range.
+  if (usec < 4)
+    return usec;
+  bit = 63 - __builtin_clzll(usec);
+  return min(bit * 4 + ((usec >> (bit - 2)) & 3), STORE_HEDGE_BUCKETS - 1);
+}
+
+uint64_t store_hedge_bucket_usec(uint32_t bucket) {
+  if (bucket < 8)
+    return bucket;
+  return (uint64_t) (4 | (bucket & 3)) << (bucket / 4 - 2);
+}
+
+uint64_t store_hedge_now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Listing
+
+struct store_iter *store_iter_new(const char *bucket, const char *prefix,
+                                  const char *after, uint32_t page_size) {
+  struct store_iter *it;
+
+  if (!(it = calloc(sizeof(*it), 1)))
+    stderror("calloc");
+  it->bucket = bucket;
+  if (!(it->prefix = strdup(prefix)))
+    stderror("strdup");
+  if (after && !(it->after = strdup(after)))
+    stderror("strdup");
+  it->page_size = page_size;
+  return it;
+}
+
+int store_iter_page(struct store_iter *it, struct store_list *list) {
+  int ret;
+
+  if (it->done)
+    return NOT_FOUND;
+
+  // Only the first page is asked for by key, every later one follows the
+  // token the service handed back.
+  if ((ret = store_list_page(it->bucket, it->prefix,
+                             it->started ? NULL : it->after, &it->token,
+                             it->page_size, list)) != SUCCESS)
+    return ret;
+
+  it->started = true;
+  if (!it->token)
+    it->done = true;
+  return SUCCESS;
+}
+
+void store_iter_free(struct store_iter *it) {
+  free(it->prefix);
+  if (it->after)
+    free(it->after);
+  if (it->token)
+    free(it->token);
+  free(it);
+}
+
+int store_scan(const char *bucket, const char *prefix, const char *alphabet,
+               uint32_t page_size,
+               int (*found)(struct store_list *page, void *arg), void *arg) {
+  struct store_scan scan;
+  pthread_t thread_id[STORE_SCAN_THREADS];
+  pthread_attr_t pattr;
+  uint32_t i;
+
+  memset(&scan, 0, sizeof(scan));
+  scan.bucket = bucket;
+  scan.alphabet = alphabet;
+  scan.page_size = page_size;
+  scan.prefix_len = strlen(prefix);
+  scan.found = found;
+  scan.arg = arg;
+  scan.ret = SUCCESS;
+  sem_init(&scan.lock, 0, 1);
+  sem_init(&scan.wake, 0, 0);
+
+  store_scan_push(&scan, prefix, NULL);
+
+  pthread_attr_init(&pattr);
+  pthread_attr_setstacksize(&pattr, STORE_ASYNC_THREAD_STACK_SIZE);
+  for (i = 0; i < STORE_SCAN_THREADS; i++) {
+    if (pthread_create(&thread_id[i], &pattr,
+                       (void *(*)(void*)) store_scan_thread, &scan) != 0)
+      error("Error creating store scan thread");
+  }
+  pthread_attr_destroy(&pattr);
+
+  for (i = 0; i < STORE_SCAN_THREADS; i++)
+    pthread_join(thread_id[i], NULL);
+
+  sem_destroy(&scan.lock);
+  sem_destroy(&scan.wake);
+  return scan.ret;
+}
+
+void store_scan_push(struct store_scan *scan, const char *prefix,
+                     const char *after) {
+  struct store_scan_part *part;
+
+  if (!(part = calloc(sizeof(*part), 1)))
+    stderror("calloc");
+  if (!(part->prefix = strdup(prefix)))
+    stderror("strdup");
+  if (after && !(part->after = strdup(after)))
+    stderror("strdup");
+
+  sem_wait(&scan->lock);
+  part->next = scan->head;
+  scan->head = part;
+  scan->pending++;
+  sem_post(&scan->lock);
+
+  sem_post(&scan->wake);
+}
+
+int store_scan_part(struct store_scan *scan, struct store_scan_part *part) {
+  struct store_iter *it;
+  struct store_list *list;
+  const char *last, *c;
+  char *child;
+  uint32_t len;
+  bool first;
+  int ret;
+
+  it = store_iter_new(scan->bucket, part->prefix, part->after,
+                      scan->page_size);
+  len = strlen(part->prefix);
+
+  for (first = true; ; first = false) {
+    list = store_list_new();
+    if ((ret = store_iter_page(it, list)) != SUCCESS) {
+      store_list_free(list);
+      break;
+    }
+    if (list->size && (ret = scan->found(list, scan->arg)) != SUCCESS) {
+      store_list_free(list);
+      break;
+    }
+
+    // A partition that fills its first page is split up, the children that
+    // sort before the last key were covered by the page already.
+    if (first && !it->done && list->size &&
+        len < scan->prefix_len + STORE_SCAN_MAX_DEPTH) {
+      last = list->item[list->size - 1];
+      if (!strncmp(last, part->prefix, len) && last[len] &&
+          strchr(scan->alphabet, last[len])) {
+        if (!(child = malloc(len + 2)))
+          stderror("malloc");
+        memcpy(child, part->prefix, len);
+        child[len + 1] = 0;
+        for (c = scan->alphabet; *c; c++) {
+          if (*c < last[len])
+            continue;
+          child[len] = *c;
+          store_scan_push(scan, child, *c == last[len] ? last : NULL);
+        }
+        free(child);
+        store_list_free(list);
+        break;
+      }
+    }
+    store_list_free(list);
+  }
+
+  store_iter_free(it);
+  return ret == NOT_FOUND ? SUCCESS : ret;
+}
+
+void store_scan_thread(struct store_scan *scan) {
+  struct store_scan_part *part;
+  uint32_t i;
+  int ret;
+
+  while (true) {
+    sem_wait(&scan->wake);
+
+    sem_wait(&scan->lock);
+    if ((part = scan->head))
+      scan->head = part->next;
+    sem_post(&scan->lock);
+
+    if (!part)
+      break;
+
+    if (scan->ret == SUCCESS &&
+        (ret = store_scan_part(scan, part)) != SUCCESS)
+      scan->ret = ret;
+
+    free(part->prefix);
+    if (part->after)
+      free(part->after);
+    free(part);
+
+    // The last partition to finish lets every thread out, children are
+    // queued before their parent counts as done.
+    sem_wait(&scan->lock);
+    if (!--scan->pending) {
+      for (i = 0; i < STORE_SCAN_THREADS; i++)
+        sem_post(&scan->wake);
+    }
+    sem_post(&scan->lock);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Store list functions
 
@@ -140,6 +782,8 @@ void store_list_free(struct store_list *list) {
 
   for (i = 0; i < list->size; i++)
     free(list->item[i]);
+  if (list->item)
+    free(list->item);
   free(list);
 }
 
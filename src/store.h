@@ -11,6 +11,24 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <semaphore.h>
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Macros
+
+#define STORE_ASYNC_THREADS           8
+#define STORE_ASYNC_MAX_THREADS       256
+#define STORE_ASYNC_THREAD_STACK_SIZE (1 * 1024 * 1024)
+
+#define STORE_SCAN_THREADS            16
+#define STORE_SCAN_MAX_DEPTH          40
+
+#define STORE_HEDGE_BUDGET            5
+#define STORE_HEDGE_BURST             10
+#define STORE_HEDGE_MIN_SAMPLES       100
+#define STORE_HEDGE_MIN_DELAY         10000
+#define STORE_HEDGE_WINDOW            10000
+#define STORE_HEDGE_BUCKETS           128
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Service interface objects
@@ -27,6 +45,77 @@ struct store_list {
   char **item;
 };
 
+enum store_async_op {
+  STORE_ASYNC_PUT,
+  STORE_ASYNC_GET,
+  STORE_ASYNC_EXISTS,
+  STORE_ASYNC_DELETE,
+};
+
+// An asynchronous request is filled in by the caller and handed to
+// store_submit. The completion callback runs on a store thread once ret,
+// and for a get buf and len, are set, it must not block on other requests.
+struct store_async {
+  enum store_async_op op;
+  const char *bucket, *object;
+
+  const char *data;
+  char *buf;
+  uint32_t len;
+  int ret;
+
+  void (*complete)(struct store_async *req);
+  void *arg;
+
+  struct store_async *next;
+};
+
+struct store_async_wait {
+  sem_t done;
+  int ret;
+};
+
+// A hedged get sends a second copy of a request that is slower than the
+// latency percentile and takes whichever answer arrives first. The last
+// of the waiter and the requests in flight to let go frees it.
+struct store_hedge {
+  struct store_async req[2];
+  char *bucket, *object;
+  uint64_t start;
+  uint32_t refs, outstanding;
+  int32_t winner;
+  sem_t lock, done;
+};
+
+// Walks every key under a prefix page by page. A page holds the keys after
+// the given one, the continuation token carries on from the last page.
+struct store_iter {
+  const char *bucket;
+  char *prefix, *after, *token;
+  uint32_t page_size;
+  bool started, done;
+};
+
+// A parallel scan splits a partition into one child per alphabet character
+// once it turns out to be larger than a page, every key after the prefix
+// must be made of characters from the alphabet.
+struct store_scan_part {
+  char *prefix, *after;
+  struct store_scan_part *next;
+};
+
+struct store_scan {
+  const char *bucket, *alphabet;
+  uint32_t page_size, prefix_len;
+  int (*found)(struct store_list *page, void *arg);
+  void *arg;
+
+  struct store_scan_part *head;
+  uint32_t pending;
+  int ret;
+  sem_t lock, wake;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Service table definition
 
@@ -40,12 +129,19 @@ struct store_intr {
 
   int (*list_object)   (const char *bucket, const char *prefix,
                         uint32_t max_count, struct store_list *list);
+  int (*list_page)     (const char *bucket, const char *prefix,
+                        const char *after, char **token,
+                        uint32_t max_count, struct store_list *list);
   int (*put_object)    (const char *bucket, const char *object,
                         const char *buf, uint32_t len);
   int (*get_object)    (const char *bucket, const char *object,
                         char **buf, uint32_t *len);
   int (*exists_object) (const char *bucket, const char *object);
   int (*delete_object) (const char *bucket, const char *object);
+  int (*delete_objects)(const char *bucket, const char **object,
+                        uint32_t count);
+
+  int (*submit)        (struct store_async *req);
 };
 
 struct store_intr_opt {
@@ -68,12 +164,59 @@ int store_delete_bucket(const char *bucket);
 
 int store_list_object(const char *bucket, const char *prefix,
                       uint32_t max_count, struct store_list *list);
+int store_list_page(const char *bucket, const char *prefix,
+                    const char *after, char **token,
+                    uint32_t max_count, struct store_list *list);
 int store_put_object(const char *bucket, const char *object,
                      const char *buf, uint32_t len);
 int store_get_object(const char *bucket, const char *object,
                      char **buf, uint32_t *len);
 int store_exists_object(const char *bucket, const char *object);
 int store_delete_object(const char *bucket, const char *object);
+int store_delete_objects(const char *bucket, const char **object,
+                         uint32_t count);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Asynchronous requests
+
+void store_submit(struct store_async *req);
+void store_async_defer(struct store_async *req);
+void store_async_start();
+void store_async_stop();
+void store_async_run(struct store_async *req);
+void store_async_thread(void *__unused);
+int store_async_delete_objects(const char *bucket, const char **object,
+                               uint32_t count);
+void store_async_delete_complete(struct store_async *req);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Hedged requests
+
+int store_hedge_get(const char *bucket, const char *object,
+                    char **buf, uint32_t *len);
+void store_hedge_complete(struct store_async *req);
+void store_hedge_release(struct store_hedge *hedge);
+bool store_hedge_take();
+void store_hedge_record(uint64_t usec);
+uint32_t store_hedge_bucket(uint64_t usec);
+uint64_t store_hedge_bucket_usec(uint32_t bucket);
+uint64_t store_hedge_now();
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Listing
+
+struct store_iter *store_iter_new(const char *bucket, const char *prefix,
+                                  const char *after, uint32_t page_size);
+int store_iter_page(struct store_iter *it, struct store_list *list);
+void store_iter_free(struct store_iter *it);
+
+int store_scan(const char *bucket, const char *prefix, const char *alphabet,
+               uint32_t page_size,
+               int (*found)(struct store_list *page, void *arg), void *arg);
+void store_scan_push(struct store_scan *scan, const char *prefix,
+                     const char *after);
+int store_scan_part(struct store_scan *scan, struct store_scan_part *part);
+void store_scan_thread(struct store_scan *scan);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Store list functions
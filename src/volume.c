@@ -17,6 +17,7 @@
 #include "crypt.h"
 #include "pack.h"
 #include "object.h"
+#include "exist.h"
 #include "volume.h"
 #include "format/vfs.h"
 #include "format/block.h"
@@ -42,6 +43,8 @@ const struct volume_intr *volume_intr_ptr = NULL;
 
 static const char *volume_selected = NULL;
 
+static uint64_t volume_ctime = 0;
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Volume operations
 
@@ -300,37 +303,17 @@ void volume_list() {
 }
 
 void volume_delete() {
-  struct store_list *list;
-  uint32_t i, obj_len;
   char obj_name[VOLUME_OBJECT_STRING_MAX],
        md_name[VOLUME_METADATA_STRING_MAX];
-  bool found;
 
   snprintf(obj_name, sizeof(obj_name), VOLUME_OBJECT_PREFIX "%s.",
            volume_selected);
-  obj_len = strlen(obj_name);
-
-  while (1) {
-    list = store_list_new();
-
-    if (store_list_object(bucket_get_selected(),
-                          obj_name, VOLUME_MAX, list) != SUCCESS)
-      error("Unable to list objects");
-
-    for (found = false, i = 0; i < list->size; i++) {
-      if (strncmp(list->item[i], obj_name, obj_len) != 0)
-        break;
-
-      if (store_delete_object(bucket_get_selected(), list->item[i]) != SUCCESS)
-        error("Object deleting failed");
-      found = true;
-    }
 
-    store_list_free(list);
-
-    if (!found)
-      break;
-  }
+  // Every page is deleted as soon as it is listed, while the other
+  // partitions of the scan keep listing.
+  if (store_scan(bucket_get_selected(), obj_name, VOLUME_OBJECT_ALPHABET,
+                 VOLUME_DELETE_PAGE, volume_delete_page, NULL) != SUCCESS)
+    error("Object deleting failed");
 
   volume_metadata_string(md_name);
   if (store_delete_object(bucket_get_selected(), md_name) != SUCCESS)
@@ -339,6 +322,11 @@ void volume_delete() {
   notice("Volume \"%s\" has been deleted", volume_selected);
 }
 
+int volume_delete_page(struct store_list *page, void *arg) {
+  return store_delete_objects(bucket_get_selected(),
+                              (const char**) page->item, page->size);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Volume mutex
 
@@ -416,6 +404,7 @@ void volume_intr_load(struct volume_metadata **md_out) {
   if (!volume_intr_set_format(md->format))
     error("Invalid volume format specified");
 
+  volume_ctime = md->ctime;
   *md_out = md;
 }
 
@@ -465,9 +454,50 @@ int volume_put_object(struct volume_object object, const char *buf,
     cr_len = pk_len;
   }
 
+  // Marked for the whole request, so a delete that races with this upload
+  // can never leave the index claiming the object is absent.
+  exist_put_begin(object);
+
   volume_object_string(obj_name, object);
   ret = store_put_object(bucket_get_selected(), obj_name, cr_buf, cr_len);
   free(cr_buf);
+
+  exist_put_end(object);
+  return ret;
+}
+
+int volume_put_object_reserved(struct volume_object object, uint32_t len,
+                               struct volume_buffer *vb) {
+  char obj_name[VOLUME_OBJECT_STRING_MAX], *buf, *pk_buf, *cr_buf;
+  uint32_t pk_len, cr_len;
+  int ret;
+
+  assert(len <= vb->size);
+
+  // The data is always taken from the upload buffer, never from the caller,
+  // so the headroom that pack_compress_reserved writes into is ours.
+  buf = volume_buffer_data(vb);
+
+  // Same as volume_put_object, but every stage writes into the buffers of
+  // the caller, and data that does not compress is never copied at all.
+  if (!pack_compress_reserved(buf, len, vb->pack, &pk_buf, &pk_len))
+    return SYS_ERROR;
+
+  if (crypt_has_cipher()) {
+    if (!crypt_enc_into(pk_buf, pk_len, vb->crypt, &cr_len))
+      return SYS_ERROR;
+    cr_buf = vb->crypt;
+  } else {
+    cr_buf = pk_buf;
+    cr_len = pk_len;
+  }
+
+  exist_put_begin(object);
+
+  volume_object_string(obj_name, object);
+  ret = store_put_object(bucket_get_selected(), obj_name, cr_buf, cr_len);
+
+  exist_put_end(object);
   return ret;
 }
 
@@ -476,6 +506,9 @@ int volume_get_object(struct volume_object object, char **buf, uint32_t *len) {
   uint32_t out_len, pk_len, cr_len;
   int ret;
 
+  if (!exist_query(object))
+    return NOT_FOUND;
+
   volume_object_string(obj_name, object);
   if ((ret = store_get_object(bucket_get_selected(), obj_name,
                               &out_buf, &out_len)) != SUCCESS)
@@ -506,15 +539,93 @@ int volume_get_object(struct volume_object object, char **buf, uint32_t *len) {
 int volume_exists_object(struct volume_object object) {
   char obj_name[VOLUME_OBJECT_STRING_MAX];
 
+  if (!exist_query(object))
+    return NOT_FOUND;
+
   volume_object_string(obj_name, object);
   return store_exists_object(bucket_get_selected(), obj_name);
 }
 
 int volume_delete_object(struct volume_object object) {
   char obj_name[VOLUME_OBJECT_STRING_MAX];
+  uint64_t stamp;
+  int ret;
+
+  if (!exist_query(object))
+    return NOT_FOUND;
+
+  stamp = exist_delete_begin();
 
   volume_object_string(obj_name, object);
-  return store_delete_object(bucket_get_selected(), obj_name);
+  ret = store_delete_object(bucket_get_selected(), obj_name);
+
+  if (ret == SUCCESS || ret == NOT_FOUND)
+    exist_clear(object, stamp);
+  return ret;
+}
+
+int volume_delete_objects(const struct volume_object *object,
+                          uint32_t count) {
+  char *names;
+  const char **list;
+  uint32_t i, num;
+  uint64_t stamp;
+  int ret;
+
+  if (!(names = malloc(count * VOLUME_OBJECT_STRING_MAX)))
+    stderror("malloc");
+  if (!(list = malloc(count * sizeof(*list))))
+    stderror("malloc");
+
+  for (num = 0, i = 0; i < count; i++) {
+    if (!exist_query(object[i]))
+      continue;
+    list[num] = names + num * VOLUME_OBJECT_STRING_MAX;
+    volume_object_string((char*) list[num], object[i]);
+    num++;
+  }
+
+  stamp = exist_delete_begin();
+
+  if ((ret = store_delete_objects(bucket_get_selected(), list, num)) ==
+      SUCCESS) {
+    for (i = 0; i < count; i++)
+      exist_clear(object[i], stamp);
+  }
+
+  free(list);
+  free(names);
+  return ret;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Volume upload buffers
+
+void volume_buffer_init(struct volume_buffer *vb, uint32_t size) {
+  vb->size = size;
+
+  if (!(vb->data = malloc(VOLUME_HEADROOM + size)))
+    stderror("malloc");
+  if (!(vb->pack = malloc(pack_bound(size))))
+    stderror("malloc");
+
+  vb->crypt = NULL;
+  if (crypt_has_cipher()) {
+    if (!(vb->crypt = malloc(crypt_bound(pack_bound(size)))))
+      stderror("malloc");
+  }
+}
+
+void volume_buffer_free(struct volume_buffer *vb) {
+  free(vb->data);
+  free(vb->pack);
+  if (vb->crypt)
+    free(vb->crypt);
+  memset(vb, 0, sizeof(*vb));
+}
+
+char *volume_buffer_data(struct volume_buffer *vb) {
+  return vb->data + VOLUME_HEADROOM;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -582,3 +693,7 @@ void volume_size_to_str(uint64_t size, char *str, uint32_t len) {
 const char *volume_get_selected() {
   return volume_selected;
 }
+
+uint64_t volume_get_ctime() {
+  return volume_ctime;
+}
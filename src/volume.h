@@ -12,6 +12,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "store.h"
+#include "pack.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Macros
@@ -19,6 +20,7 @@
 #define VOLUME_VERSION              1
 
 #define VOLUME_MAX                  256
+#define VOLUME_DELETE_PAGE          1000
 #define VOLUME_CAP_STRING_MAX       32
 #define VOLUME_NAME_MAX             64
 
@@ -37,9 +39,12 @@
 #define VOLUME_OBJECT_PREFIX        "cloudfs.object."
 #define VOLUME_OBJECT_STRING_MAX    (sizeof(VOLUME_OBJECT_PREFIX) + \
                                      VOLUME_NAME_MAX + 35)
+#define VOLUME_OBJECT_ALPHABET      ".0123456789abcdef"
 
 #define VOLUME_LIST_FORMAT          "%-15s %-8s %-10s %-21s %-6s %-8s"
 
+#define VOLUME_HEADROOM             PACK_HEADROOM
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Volume object identifier
 
@@ -47,6 +52,16 @@ struct volume_object {
   uint64_t index, chunk;
 };
 
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Volume upload buffers
+
+// The data is written at volume_buffer_data, which leaves the headroom that
+// pack_compress_reserved needs in front of it.
+struct volume_buffer {
+  char *data, *pack, *crypt;
+  uint32_t size;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Volume metadata structure
 
@@ -104,6 +119,7 @@ void volume_unmount();
 void volume_fsck();
 void volume_list();
 void volume_delete();
+int volume_delete_page(struct store_list *page, void *arg);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Volume mutex
@@ -125,9 +141,20 @@ int volume_list_object(struct volume_object prefix, uint32_t max_count,
                        struct store_list *list);
 int volume_put_object(struct volume_object object, const char *buf,
                       uint32_t len);
+int volume_put_object_reserved(struct volume_object object, uint32_t len,
+                               struct volume_buffer *vb);
 int volume_get_object(struct volume_object object, char **buf, uint32_t *len);
 int volume_exists_object(struct volume_object object);
 int volume_delete_object(struct volume_object object);
+int volume_delete_objects(const struct volume_object *object,
+                          uint32_t count);
+
+////////////////////////////////////////////////////////////////////////////////
+// Section:     Volume upload buffers
+
+void volume_buffer_init(struct volume_buffer *vb, uint32_t size);
+void volume_buffer_free(struct volume_buffer *vb);
+char *volume_buffer_data(struct volume_buffer *vb);
 
 ////////////////////////////////////////////////////////////////////////////////
 // Section:     Object name formatting
@@ -147,3 +174,4 @@ void volume_size_to_str(uint64_t size, char *str, uint32_t len);
 // Section:     Volume selection
 
 const char *volume_get_selected();
+uint64_t volume_get_ctime();